@@ -2,18 +2,25 @@
 # This program is free software.
 
 VERSION = 0.5.9
+# bumped whenever the libxcandb ABI breaks
+SOVERSION = 1
 
 PREFIX = /usr/local
 MANPREFIX = $(PREFIX)/share/man
 
 PKG_CONFIG = pkg-config
 
-DEPENDENCIES = xcb xcb-image xcb-cursor xcb-keysyms xcb-xkb xcb-shm
+DEPENDENCIES = xcb xcb-cursor xcb-keysyms xcb-xkb xcb-shm xcb-present xcb-xfixes xcb-render libjpeg zlib
 
 INCS = $(shell $(PKG_CONFIG) --cflags $(DEPENDENCIES)) -Iinclude
-LIBS = $(shell $(PKG_CONFIG) --libs $(DEPENDENCIES)) -lm
+LIBS = $(shell $(PKG_CONFIG) --libs $(DEPENDENCIES)) -lm -lpthread
 
-CFLAGS = -std=c99 -pedantic -Wall -Wextra -Os $(INCS) -DVERSION=\"$(VERSION)\"
+# libxcandb only needs what the pixel core does
+LIBDEPENDENCIES = libjpeg zlib
+LIBLIBS = $(shell $(PKG_CONFIG) --libs $(LIBDEPENDENCIES)) -lm -lpthread
+
+CFLAGS = -std=c99 -pedantic -Wall -Wextra -Os -fPIC -fvisibility=hidden $(INCS) -DVERSION=\"$(VERSION)\"
 LDFLAGS = -s $(LIBS)
+LIBLDFLAGS = -s $(LIBLIBS)
 
 CC = cc
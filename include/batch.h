@@ -0,0 +1,40 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include "image.h"
+
+/* an edit given on the command line or in a batch file: */
+/* type is 'c' to crop or 'b' to blur, strength blur passes */
+typedef struct {
+	char type;
+	int x, y;
+	int width, height;
+	int strength;
+} Edit_t;
+
+/* applies the edits to every path and saves the result under */
+/* outdir with the same name, spreading the work over all cpus; */
+/* report, if not NULL, is called with each path that fails, */
+/* maybe from another thread. returns how many failed, or -1 */
+/* without touching any when two of them have the same name */
+/* or there is no memory to start */
+extern XCANDB_API int
+batch_run(char **paths, int npaths, const Edit_t *edits, int nedits,
+		const char *outdir, void (*report)(const char *path));
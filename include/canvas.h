@@ -18,16 +18,39 @@
 
 #pragma once
 
+#include <stddef.h>
 #include <xcb/xcb.h>
 
+#include "image.h"
+
+#define CANVAS_ZOOM_MIN (1.0f / 64)
+#define CANVAS_ZOOM_MAX 32.0f
+#define CANVAS_HISTORY_BUDGET ((size_t)256 << 20)
+
 typedef struct Canvas Canvas_t;
 
 extern Canvas_t *
 canvas_load(xcb_connection_t *conn, xcb_window_t win, const char *path);
 
-extern void
+extern Canvas_t *
+canvas_load_region(xcb_connection_t *conn, xcb_window_t win, const char *path,
+		int x, int y, int w, int h);
+
+extern Canvas_t *
+canvas_load_memory(xcb_connection_t *conn, xcb_window_t win,
+		const unsigned char *data, size_t len, int x, int y, int w, int h);
+
+extern Canvas_t *
+canvas_capture(xcb_connection_t *conn, xcb_window_t win, xcb_drawable_t src,
+		int x, int y, int w, int h);
+
+extern int
 canvas_save(Canvas_t *c, const char *path);
 
+/* a copy of the image, to be freed with image_free */
+extern Image_t *
+canvas_copy(Canvas_t *c);
+
 extern void
 canvas_crop(Canvas_t *c, int x, int y, int w, int h);
 
@@ -40,12 +63,56 @@ canvas_blur(Canvas_t *c, int x, int y, int w, int h, int strength);
 extern void
 canvas_move_relative(Canvas_t *c, int offx, int offy);
 
-extern void
+/* returns nonzero when the frame was reallocated, its */
+/* contents are undefined until the next canvas_render */
+extern int
 canvas_set_viewport(Canvas_t *c, int vw, int vh);
 
+extern float
+canvas_get_zoom(Canvas_t *c);
+
+extern void
+canvas_set_zoom(Canvas_t *c, float zoom, int x, int y);
+
+extern int
+canvas_undo(Canvas_t *c);
+
+extern int
+canvas_redo(Canvas_t *c);
+
+extern int
+canvas_adjust_strength(Canvas_t *c, int delta);
+
+extern void
+canvas_use_edit_list(Canvas_t *c);
+
+extern void
+canvas_set_history_budget(Canvas_t *c, size_t bytes);
+
+extern void
+canvas_set_ram_budget(size_t bytes);
+
+extern int
+canvas_use_xrender_zoom(Canvas_t *c);
+
+extern void
+canvas_set_background(Canvas_t *c, uint32_t color);
+
+extern void
+canvas_use_window_background(Canvas_t *c);
+
+extern void
+canvas_set_selection(Canvas_t *c, const xcb_rectangle_t *r);
+
+extern void
+canvas_damage(Canvas_t *c, int x, int y, int w, int h);
+
 extern void
 canvas_render(Canvas_t *c);
 
+extern int
+canvas_handle_event(Canvas_t *c, xcb_generic_event_t *ev);
+
 extern void
 canvas_viewport_to_canvas_pos(Canvas_t *c, int x, int y, int *out_x, int *out_y);
 
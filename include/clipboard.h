@@ -0,0 +1,49 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include <xcb/xcb.h>
+
+#include "canvas.h"
+
+extern void
+clipboard_init(xcb_connection_t *conn, xcb_window_t win);
+
+extern int
+clipboard_own(Canvas_t *c, xcb_timestamp_t time);
+
+extern void
+clipboard_handle_request(xcb_selection_request_event_t *ev);
+
+extern void
+clipboard_handle_clear(xcb_selection_clear_event_t *ev);
+
+extern void
+clipboard_handle_property(xcb_property_notify_event_t *ev);
+
+extern void
+clipboard_handle_destroy(xcb_destroy_notify_event_t *ev);
+
+/* the image in the clipboard, encoded, to be freed by the caller */
+extern unsigned char *
+clipboard_read(size_t *len);
+
+extern void
+clipboard_free(void);
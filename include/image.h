@@ -0,0 +1,101 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the pixel core, with no display behind it: pixels */
+/* are 0xAARRGGBB and stride is in pixels; it never exits, */
+/* running out of memory fails with -1 or NULL instead */
+
+#define IMAGE_BLUR_RADIUS 3
+
+/* the only symbols libxcandb exports, it's built */
+/* with everything else hidden */
+#define XCANDB_API __attribute__((visibility("default")))
+
+typedef struct {
+	int width;
+	int height;
+	int stride;
+	uint32_t *px;
+
+	/* what px was allocated as, crops move px over it */
+	uint32_t *buf;
+
+	/* the jpeg it was decoded from and where the image */
+	/* sits in it, so crops are saved without re-encoding */
+	struct {
+		unsigned char *data;
+		size_t len;
+		int x;
+		int y;
+	} jpg;
+} Image_t;
+
+/* gives the pixels a w by h image is decoded into, with */
+/* a stride of w; image_read never frees what it returns */
+typedef uint32_t *(*ImageAllocator)(void *ctx, int w, int h);
+
+extern XCANDB_API int
+image_clip(int iw, int ih, int *x, int *y, int *w, int *h);
+
+extern XCANDB_API int
+image_read(FILE *fp, int x, int y, int w, int h,
+		ImageAllocator alloc, void *ctx, Image_t *img);
+
+extern XCANDB_API int
+image_write(const Image_t *img, const char *path, FILE *fp);
+
+/* a copy as 8-bit rgba, to be freed by the caller */
+extern XCANDB_API unsigned char *
+image_rgba(const Image_t *img);
+
+extern XCANDB_API void
+image_grayscale_pixels(uint32_t *px, int stride, int w, int h);
+
+/* works in bands of rows, so the memory it takes */
+/* depends on w and strength but not on h; fails */
+/* with -1 for a strength below 1, as image_blur */
+extern XCANDB_API int
+image_blur_pixels(uint32_t *px, int stride, int w, int h, int strength);
+
+extern XCANDB_API Image_t *
+image_load(const char *path, int x, int y, int w, int h);
+
+extern XCANDB_API int
+image_save(const Image_t *img, const char *path);
+
+extern XCANDB_API void
+image_crop(Image_t *img, int x, int y, int w, int h);
+
+extern XCANDB_API void
+image_grayscale(Image_t *img, int x, int y, int w, int h);
+
+extern XCANDB_API int
+image_blur(Image_t *img, int x, int y, int w, int h, int strength);
+
+/* a compact copy of the pixels, without the jpeg */
+extern XCANDB_API Image_t *
+image_copy(const Image_t *img);
+
+extern XCANDB_API void
+image_free(Image_t *img);
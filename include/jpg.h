@@ -0,0 +1,45 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+extern int
+jpg_is_jpeg(const unsigned char *data, size_t len);
+
+extern int
+jpg_info(const unsigned char *data, size_t len, int *w, int *h);
+
+/* only the w by h region at x, y is written to px, */
+/* as 0xAARRGGBB, stride is in pixels */
+extern int
+jpg_decode(const unsigned char *data, size_t len, uint32_t *px, int stride,
+		int x, int y, int w, int h);
+
+/* writes the w by h region at x, y without re-encoding it, */
+/* fails when x, y doesn't start an iMCU (an 8 or 16 px block) */
+extern int
+jpg_crop(const unsigned char *data, size_t len, int x, int y, int w, int h,
+		FILE *fp);
+
+/* encodes px, 0xAARRGGBB with stride in pixels, row by row */
+extern int
+jpg_write(FILE *fp, const uint32_t *px, int w, int h, int stride, int quality);
@@ -18,6 +18,11 @@
 
 #pragma once
 
+/* messages go to notify-send when stdout isn't a terminal, */
+/* unless told to always use stderr as when there's no window */
+extern void
+log_use_stderr(void);
+
 extern void
 info(const char *fmt, ...);
 
@@ -1,5 +1,5 @@
 /*
-	Copyright (C) 2023 <alpheratz99@protonmail.com>
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
 
 	This program is free software; you can redistribute it and/or modify it
 	under the terms of the GNU General Public License version 2 as published by
@@ -16,7 +16,12 @@
 
 */
 
-#define STB_IMAGE_IMPLEMENTATION
-#include "stb/stb_image.h"
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb/stb_image_write.h"
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* encodes px, 0xAARRGGBB with stride in pixels, as 8-bit */
+/* rgba a row at a time, never holding more than two of them */
+extern int
+png_write(FILE *fp, const uint32_t *px, int w, int h, int stride);
@@ -0,0 +1,36 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* pixels are read and written as 0xAARRGGBB, stride is in pixels */
+
+extern int
+qoi_info(const unsigned char *data, size_t len, int *w, int *h);
+
+/* only the w by h region at x, y is written to px */
+extern int
+qoi_decode(const unsigned char *data, size_t len, uint32_t *px, int stride,
+		int x, int y, int w, int h);
+
+extern int
+qoi_write(FILE *fp, const uint32_t *px, int w, int h, int stride);
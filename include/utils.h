@@ -21,6 +21,9 @@
 #include <stdbool.h>
 #include <stddef.h>
 
+#define MIN(a,b) ((a)<(b)?(a):(b))
+#define MAX(a,b) ((a)>(b)?(a):(b))
+
 #define CLAMP(v,min,max) \
 	((v)>(max)?(max):(v)<(min)?(min):(v))
 
@@ -33,6 +36,9 @@ xmalloc(size_t size);
 extern void *
 xcalloc(size_t nmemb, size_t size);
 
+extern void *
+xrealloc(void *ptr, size_t size);
+
 extern char *
 xstrdup(const char *str);
 
@@ -0,0 +1,440 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "image.h"
+#include "utils.h"
+
+/* blurs larger than this are split into bands of about */
+/* this many pixels, so a few huge images use every cpu too */
+#define BATCH_BAND_PIXELS (256*1024)
+
+struct Pool;
+
+struct Task {
+	void (*run)(struct Pool *pool, int self, void *arg);
+	void *arg;
+};
+
+/* the worker owning it takes its newest task, the others */
+/* steal the oldest, which is the largest amount of work */
+struct Deque {
+	pthread_mutex_t lock;
+	struct Task *tasks;
+	int top;
+	int bottom;
+	int cap;
+};
+
+struct Band {
+	const uint32_t *src;
+	uint32_t *dst;
+	int stride;
+	int w, h;
+	int y0, y1;
+	int strength;
+	int *left;
+	int *failed;
+};
+
+/* one per batch_run, so batches can run side by side */
+struct Pool {
+	int nworkers;
+	struct Deque *deques;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int queued;
+	int pending;
+	int failed;
+	const Edit_t *edits;
+	int nedits;
+	const char *outdir;
+	void (*report)(const char *path);
+};
+
+struct Worker {
+	struct Pool *pool;
+	int self;
+	pthread_t thread;
+};
+
+static int
+__deque_push(struct Deque *d, struct Task t)
+{
+	struct Task *tasks;
+	int cap;
+
+	pthread_mutex_lock(&d->lock);
+
+	if (d->bottom == d->cap) {
+		memmove(d->tasks, &d->tasks[d->top],
+				(d->bottom - d->top) * sizeof(struct Task));
+		d->bottom -= d->top;
+		d->top = 0;
+		if (d->bottom == d->cap) {
+			cap = d->cap > 0 ? 2*d->cap : 64;
+			if (NULL == (tasks = realloc(d->tasks, cap * sizeof(struct Task)))) {
+				pthread_mutex_unlock(&d->lock);
+				return -1;
+			}
+			d->tasks = tasks;
+			d->cap = cap;
+		}
+	}
+
+	d->tasks[d->bottom++] = t;
+	pthread_mutex_unlock(&d->lock);
+
+	return 0;
+}
+
+static int
+__deque_take(struct Deque *d, int steal, struct Task *t)
+{
+	int found;
+
+	pthread_mutex_lock(&d->lock);
+
+	if ((found = d->top < d->bottom))
+		*t = steal ? d->tasks[d->top++] : d->tasks[--d->bottom];
+
+	pthread_mutex_unlock(&d->lock);
+
+	return found;
+}
+
+static void
+__batch_push(struct Pool *pool, int self,
+		void (*run)(struct Pool *, int, void *), void *arg)
+{
+	/* with no room to queue it, it's done right away */
+	if (__deque_push(&pool->deques[self], (struct Task) { run, arg }) < 0) {
+		run(pool, self, arg);
+		return;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	pool->queued++;
+	pool->pending++;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int
+__batch_take(struct Pool *pool, int self, struct Task *t)
+{
+	int i;
+
+	for (i = 0; i < pool->nworkers; ++i) {
+		if (__deque_take(&pool->deques[(self + i) % pool->nworkers], i > 0, t)) {
+			pthread_mutex_lock(&pool->lock);
+			pool->queued--;
+			pthread_mutex_unlock(&pool->lock);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static void
+__batch_work(struct Pool *pool, int self, const int *left)
+{
+	struct Task t;
+
+	/* runs tasks until *left drops to zero, so a worker */
+	/* waiting for its bands helps with them meanwhile */
+	pthread_mutex_lock(&pool->lock);
+
+	while (*left > 0) {
+		if (pool->queued == 0) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool->lock);
+
+		if (__batch_take(pool, self, &t)) {
+			t.run(pool, self, t.arg);
+			pthread_mutex_lock(&pool->lock);
+			if (--pool->pending == 0)
+				pthread_cond_broadcast(&pool->cond);
+		} else {
+			pthread_mutex_lock(&pool->lock);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+__batch_fail(struct Pool *pool, const char *path)
+{
+	pthread_mutex_lock(&pool->lock);
+	pool->failed++;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (NULL != pool->report)
+		pool->report(path);
+}
+
+static void
+__batch_band(struct Pool *pool, int self, void *arg)
+{
+	struct Band *b;
+	uint32_t *win;
+	int halo, wy0, wy1, y, failed;
+
+	(void) self;
+
+	b = arg;
+
+	/* every pass reaches IMAGE_BLUR_RADIUS rows further, so */
+	/* with that many rows per pass around it, the band comes */
+	/* out as if the whole rectangle had been blurred at once */
+	halo = IMAGE_BLUR_RADIUS * b->strength;
+	wy0 = MAX(0, b->y0 - halo);
+	wy1 = MIN(b->h, b->y1 + halo);
+
+	failed = NULL == (win = malloc((size_t)4 * b->w * (wy1 - wy0)));
+
+	if (!failed) {
+		memcpy(win, &b->src[(size_t)wy0*b->w], (size_t)4 * b->w * (wy1 - wy0));
+		failed = image_blur_pixels(win, b->w, b->w, wy1 - wy0, b->strength) < 0;
+	}
+
+	if (!failed)
+		for (y = b->y0; y < b->y1; ++y)
+			memcpy(&b->dst[(size_t)y*b->stride], &win[(size_t)(y - wy0)*b->w],
+					(size_t)4 * b->w);
+
+	free(win);
+
+	pthread_mutex_lock(&pool->lock);
+	*b->failed |= failed;
+	--*b->left;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int
+__batch_blur(struct Pool *pool, int self, Image_t *img, const Edit_t *e)
+{
+	int x, y, w, h, rows, nbands, left, failed, i;
+	struct Band *bands;
+	uint32_t *src, *dst;
+
+	x = e->x; y = e->y;
+	w = e->width; h = e->height;
+
+	/* a band height of zero would never split the area */
+	if (e->strength < 1)
+		return -1;
+
+	if (image_clip(img->width, img->height, &x, &y, &w, &h) < 0)
+		return 0;
+
+	/* a band blurs its halo on both sides too, so it's kept */
+	/* well taller than that, or splitting would cost more */
+	rows = MAX(4 * IMAGE_BLUR_RADIUS * e->strength, BATCH_BAND_PIXELS / w);
+	nbands = (h + rows - 1) / rows;
+
+	/* bands read their neighbours' rows, so they all */
+	/* read from a copy taken before any of them writes */
+	src = pool->nworkers > 1 && nbands > 1 ? malloc((size_t)4*w*h) : NULL;
+	bands = NULL != src ? malloc(nbands * sizeof(struct Band)) : NULL;
+
+	if (NULL == bands) {
+		free(src);
+		return image_blur(img, x, y, w, h, e->strength);
+	}
+
+	/* edited pixels can't come from the jpeg anymore */
+	free(img->jpg.data);
+	img->jpg.data = NULL;
+
+	dst = &img->px[(size_t)y*img->stride + x];
+
+	for (i = 0; i < h; ++i)
+		memcpy(&src[(size_t)i*w], &dst[(size_t)i*img->stride], (size_t)4*w);
+
+	left = nbands;
+	failed = 0;
+
+	for (i = 0; i < nbands; ++i) {
+		bands[i].src = src;
+		bands[i].dst = dst;
+		bands[i].stride = img->stride;
+		bands[i].w = w;
+		bands[i].h = h;
+		bands[i].y0 = i * rows;
+		bands[i].y1 = MIN(h, (i + 1) * rows);
+		bands[i].strength = e->strength;
+		bands[i].left = &left;
+		bands[i].failed = &failed;
+		__batch_push(pool, self, __batch_band, &bands[i]);
+	}
+
+	__batch_work(pool, self, &left);
+
+	free(bands);
+	free(src);
+
+	return failed ? -1 : 0;
+}
+
+static const char *
+__batch_name(const char *path)
+{
+	const char *name;
+
+	return NULL == (name = strrchr(path, '/')) ? path : name + 1;
+}
+
+static void
+__batch_file(struct Pool *pool, int self, void *arg)
+{
+	const char *path, *name;
+	Image_t *img;
+	char *out;
+	int i, rc;
+
+	path = arg;
+
+	if (NULL == (img = image_load(path, 0, 0, INT_MAX, INT_MAX))) {
+		__batch_fail(pool, path);
+		return;
+	}
+
+	for (i = 0, rc = 0; i < pool->nedits && rc == 0; ++i) {
+		if (pool->edits[i].type == 'c')
+			image_crop(img, pool->edits[i].x, pool->edits[i].y,
+					pool->edits[i].width, pool->edits[i].height);
+		else
+			rc = __batch_blur(pool, self, img, &pool->edits[i]);
+	}
+
+	name = __batch_name(path);
+
+	if (rc == 0 && NULL != (out = malloc(strlen(pool->outdir) + strlen(name) + 2))) {
+		sprintf(out, "%s/%s", pool->outdir, name);
+		rc = image_save(img, out);
+		free(out);
+	} else {
+		rc = -1;
+	}
+
+	if (rc < 0)
+		__batch_fail(pool, path);
+
+	image_free(img);
+}
+
+static void *
+__batch_worker(void *arg)
+{
+	struct Worker *w;
+
+	w = arg;
+	__batch_work(w->pool, w->self, &w->pool->pending);
+
+	return NULL;
+}
+
+extern int
+batch_run(char **paths, int npaths, const Edit_t *edits, int nedits,
+		const char *outdir, void (*report)(const char *path))
+{
+	struct Pool pool;
+	struct Worker *workers;
+	long ncpus;
+	int i, j;
+
+	/* each image is saved under its name alone, two with */
+	/* the same name would be written over each other */
+	for (i = 0; i < npaths; ++i)
+		for (j = i + 1; j < npaths; ++j)
+			if (strcmp(__batch_name(paths[i]), __batch_name(paths[j])) == 0)
+				return -1;
+
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	pool.nworkers = CLAMP(ncpus, 1, 256);
+	pool.deques = calloc(pool.nworkers, sizeof(struct Deque));
+	workers = malloc(pool.nworkers * sizeof(struct Worker));
+
+	if (NULL == pool.deques || NULL == workers) {
+		free(pool.deques);
+		free(workers);
+		return -1;
+	}
+
+	pool.queued = pool.pending = pool.failed = 0;
+	pool.edits = edits;
+	pool.nedits = nedits;
+	pool.outdir = outdir;
+	pool.report = report;
+
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.cond, NULL);
+
+	for (i = 0; i < pool.nworkers; ++i)
+		pthread_mutex_init(&pool.deques[i].lock, NULL);
+
+	/* the files are dealt out evenly, from there on idle */
+	/* workers steal whole files or bands of a large blur */
+	for (i = 0; i < npaths; ++i)
+		__batch_push(&pool, i % pool.nworkers, __batch_file, paths[i]);
+
+	/* a worker that can't be started leaves its deque */
+	/* to the others, they steal from it like from any */
+	for (i = 0; i < pool.nworkers; ++i) {
+		workers[i].pool = &pool;
+		workers[i].self = i;
+		if (i > 0 && pthread_create(&workers[i].thread, NULL,
+					__batch_worker, &workers[i]) != 0)
+			workers[i].pool = NULL;
+	}
+
+	__batch_worker(&workers[0]);
+
+	for (i = 1; i < pool.nworkers; ++i)
+		if (NULL != workers[i].pool)
+			pthread_join(workers[i].thread, NULL);
+
+	for (i = 0; i < pool.nworkers; ++i) {
+		pthread_mutex_destroy(&pool.deques[i].lock);
+		free(pool.deques[i].tasks);
+	}
+
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
+	free(pool.deques);
+	free(workers);
+
+	return pool.failed;
+}
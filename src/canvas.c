@@ -16,18 +16,27 @@
 
 */
 
+#define _GNU_SOURCE
+
+#include <stdio.h>
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <math.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
-#include <xcb/xcb_image.h>
 #include <xcb/shm.h>
+#include <xcb/xfixes.h>
+#include <xcb/present.h>
+#include <xcb/render.h>
 #include <sys/shm.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
 
-#include "stb/stb_image.h"
-#include "stb/stb_image_write.h"
 #include "canvas.h"
+#include "image.h"
 #include "utils.h"
 #include "log.h"
 
@@ -36,52 +45,240 @@
 #define GREEN(c) ((c>>8) & 0xff)
 #define BLUE(c) ((c>>0) & 0xff)
 
+#define TILE_SIZE 256
+#define DAMAGE_RECTS 16
+
+#define SHM_POOL_SEGMENTS 8
+#define SHM_HUGE_PAGE_SIZE (2*1024*1024)
+
+/* protocol coordinates are 16 bit signed */
+#define X_COORD_MAX INT16_MAX
+
+/* rows paged in and out of a scratch file together */
+#define PAGING_BAND_ROWS 64
+
+/* level k is the canvas scaled down by 2^k */
+#define MIP_LEVELS 8
+
+enum {
+	STEP_PIXELS,
+	STEP_CROP,
+	STEP_OP
+};
+
+enum {
+	OP_GRAYSCALE,
+	OP_BLUR
+};
+
+enum {
+	FRAME_COPY,
+	FRAME_PRESENT,
+	FRAME_BACKGROUND
+};
+
+struct ShmSegment {
+	int used;
+	int memfd;
+	int id;
+	size_t size;
+	void *addr;
+	xcb_shm_seg_t seg;
+};
+
+struct MipLevel {
+	int width;
+	int height;
+	int cols;
+	uint32_t *px;
+	unsigned char *dirty;
+};
+
+/* rectangle of the buffer as it was before (or after, once */
+/* undone) the step, in buffer coordinates */
+struct HistoryTile {
+	int x;
+	int y;
+	int width;
+	int height;
+	uint32_t *px;
+};
+
+struct HistoryStep {
+	int type;
+	size_t bytes;
+
+	/* STEP_PIXELS */
+	int ntiles;
+	struct HistoryTile *tiles;
+	uint32_t *px;
+	unsigned char *jpg;
+	size_t jpg_len;
+
+	/* STEP_CROP, the other view over the buffer */
+	/* STEP_OP, the area the op applies to */
+	int x;
+	int y;
+	int width;
+	int height;
+
+	/* STEP_OP */
+	int op;
+	int strength;
+};
+
+/* half open, x1 and y1 are excluded */
+struct Area {
+	int x0;
+	int y0;
+	int x1;
+	int y1;
+};
+
 struct Canvas {
 	struct {
 		float x;
 		float y;
 	} pos;
 
+	float zoom;
+
 	int viewport_width;
 	int viewport_height;
 
+	/* viewport sized pixmap every frame is composed in, then */
+	/* presented, copied or shown as the window background */
+	struct {
+		int mode;
+		int pending;
+		uint32_t serial;
+		uint8_t present_opcode;
+		int width;
+		int height;
+		xcb_pixmap_t pixmap;
+		xcb_gcontext_t gc;
+		xcb_gcontext_t outline_gc;
+		xcb_xfixes_region_t region;
+	} frame;
+
+	struct {
+		int active;
+		xcb_rectangle_t rect;
+	} selection;
+
+	/* viewport sized buffer scaled frames are resampled into */
+	struct {
+		struct ShmSegment *seg;
+		uint32_t *px;
+	} view;
+
+	/* built a tile at a time, only where it's looked at */
+	struct MipLevel mip[MIP_LEVELS];
+
+	/* zoom done by the server straight from the shm pixmap */
+	struct {
+		int enabled;
+		xcb_render_pictformat_t format;
+		xcb_render_picture_t src;
+		xcb_render_picture_t dst;
+
+		/* the view on its own once a crop moved it inside */
+		/* the buffer, with its size when it was made */
+		xcb_pixmap_t pixmap;
+		int width, height;
+	} xrender;
+
+	/* viewport areas waiting to be repainted */
+	struct {
+		int count;
+		xcb_rectangle_t rects[DAMAGE_RECTS];
+	} damage;
+
 	int width;
 	int height;
+	int stride;
 	uint32_t *px;
 
+	/* captured at depth 24, the alpha bytes are whatever */
+	/* the server left there until the image is saved */
+	int opaque;
+
+	/* crops only move the view (px, width and height) */
+	/* over this buffer, no pixel gets copied */
+	struct {
+		uint32_t *px;
+		int x;
+		int y;
+		int height;
+		size_t size;
+		int mapped;
+	} buf;
+
+	/* a mapped buffer only keeps the most recently used */
+	/* bands of rows resident, within the ram budget */
+	struct {
+		int nbands;
+		int resident;
+		unsigned tick;
+		unsigned *stamp;
+	} paging;
+
+	/* steps before pos are undone, from pos on redone; */
+	/* the oldest go once they take more than budget bytes */
+	struct {
+		int count;
+		int pos;
+		size_t bytes;
+		size_t budget;
+		struct HistoryStep *steps;
+	} history;
+
+	/* edit list mode: src is never written, the buffer only */
+	/* caches what the ops in the history make of it */
+	struct {
+		int enabled;
+		uint32_t *src;
+		size_t size;
+		int mapped;
+		int cols;
+		int rows;
+		unsigned char *valid;
+	} ops;
+
+	/* the source jpeg and where the canvas sits in it, */
+	/* kept while the only edits are crops */
+	struct {
+		unsigned char *data;
+		size_t len;
+		int x;
+		int y;
+	} jpg;
+
 	/* X11 */
 	xcb_connection_t *conn;
 	xcb_screen_t *scr;
 	xcb_window_t win;
 	int shm;
+	int shm_fd;
 	xcb_gcontext_t gc;
 	union {
 		struct {
-			int id;
-			xcb_shm_seg_t seg;
+			struct ShmSegment *seg;
 			xcb_pixmap_t pixmap;
 		} shm;
-		xcb_image_t *image;
+		struct {
+			uint32_t *tile;
+			int tile_rows;
+		} put;
 	} x;
-};
-
-static inline uint32_t
-__pack_color(unsigned char *p)
-{
-	return (uint32_t)(p[3]<<24)|(p[0]<<16)|(p[1]<<8)|p[2];
-}
 
-static inline void
-__unpack_color(uint32_t c, unsigned char *p)
-{
-	p[0] = RED(c);
-	p[1] = GREEN(c);
-	p[2] = BLUE(c);
-	p[3] = ALPHA(c);
-}
+	/* segments stay attached after use, resizes and */
+	/* scratch buffers pick them up from here */
+	struct ShmSegment pool[SHM_POOL_SEGMENTS];
+};
 
 static int
-__x_check_mit_shm_extension(xcb_connection_t *conn)
+__x_check_mit_shm_extension(xcb_connection_t *conn, int *fd_passing)
 {
 	xcb_generic_error_t *error;
 	xcb_shm_query_version_cookie_t cookie;
@@ -92,314 +289,2243 @@ __x_check_mit_shm_extension(xcb_connection_t *conn)
 	reply = xcb_shm_query_version_reply(conn, cookie, &error);
 	supported = !error && reply && reply->shared_pixmaps;
 
+	/* attach_fd came with MIT-SHM 1.2 */
+	*fd_passing = supported && (reply->major_version > 1 ||
+			(reply->major_version == 1 && reply->minor_version >= 2));
+
 	free(error); free(reply);
 
 	return supported;
 }
 
-static void
-__canvas_set_size(Canvas_t *c, int w, int h)
+static int
+__x_check_present_extension(xcb_connection_t *conn, uint8_t *opcode)
 {
-	c->width = w;
-	c->height = h;
+	const xcb_query_extension_reply_t *ext;
+	xcb_present_query_version_reply_t *present;
+	xcb_xfixes_query_version_reply_t *xfixes;
+	int supported;
 
-	if (c->shm) {
-		if (c->px) {
-			shmctl(c->x.shm.id, IPC_RMID, NULL);
-			xcb_shm_detach(c->conn, c->x.shm.seg);
-			shmdt(c->px);
-			xcb_free_pixmap(c->conn, c->x.shm.pixmap);
-		}
+	ext = xcb_get_extension_data(conn, &xcb_present_id);
 
-		c->x.shm.seg = xcb_generate_id(c->conn);
-		c->x.shm.pixmap = xcb_generate_id(c->conn);
-		c->x.shm.id = shmget(IPC_PRIVATE, w*h*4, IPC_CREAT | 0600);
+	if (NULL == ext || !ext->present)
+		return 0;
 
-		if (c->x.shm.id < 0)
-			die("shmget:");
+	*opcode = ext->major_opcode;
 
-		c->px = shmat(c->x.shm.id, NULL, 0);
+	present = xcb_present_query_version_reply(conn, xcb_present_query_version(
+				conn, XCB_PRESENT_MAJOR_VERSION, XCB_PRESENT_MINOR_VERSION), NULL);
 
-		if (c->px == (void *) -1) {
-			shmctl(c->x.shm.id, IPC_RMID, NULL);
-			die("shmat:");
-		}
+	/* update regions need xfixes 2.0 */
+	xfixes = xcb_xfixes_query_version_reply(conn, xcb_xfixes_query_version(
+				conn, XCB_XFIXES_MAJOR_VERSION, XCB_XFIXES_MINOR_VERSION), NULL);
 
-		xcb_shm_attach(c->conn, c->x.shm.seg, c->x.shm.id, 0);
-		shmctl(c->x.shm.id, IPC_RMID, NULL);
+	supported = NULL != present && NULL != xfixes && xfixes->major_version >= 2;
 
-		xcb_shm_create_pixmap(c->conn, c->x.shm.pixmap, c->win, w, h,
-				c->scr->root_depth, c->x.shm.seg, 0);
-	} else {
-		if (c->px)
-			xcb_image_destroy(c->x.image);
+	free(present); free(xfixes);
+
+	return supported;
+}
+
+static int
+__x_check_render_extension(xcb_connection_t *conn, xcb_visualid_t visual,
+		xcb_render_pictformat_t *format)
+{
+	const xcb_query_extension_reply_t *ext;
+	xcb_render_query_version_reply_t *version;
+	xcb_render_query_pict_formats_reply_t *formats;
+	xcb_render_pictscreen_iterator_t screens;
+	xcb_render_pictdepth_iterator_t depths;
+	xcb_render_pictvisual_iterator_t visuals;
+	int found;
+
+	ext = xcb_get_extension_data(conn, &xcb_render_id);
+
+	if (NULL == ext || !ext->present)
+		return 0;
+
+	/* transforms and filters came with 0.6 */
+	version = xcb_render_query_version_reply(conn,
+			xcb_render_query_version(conn, 0, 11), NULL);
+
+	if (NULL == version || (version->major_version == 0 &&
+				version->minor_version < 6)) {
+		free(version);
+		return 0;
+	}
+
+	free(version);
 
-		// FIXME: split source image into
-		//        multiple xcb_image_t objects
-		if (w*h*4 > 16*1024*1024 /* 16mb */)
-			die("image too big for one xcb_image_t");
+	formats = xcb_render_query_pict_formats_reply(conn,
+			xcb_render_query_pict_formats(conn), NULL);
 
-		c->px = xmalloc(w*h*4);
+	if (NULL == formats)
+		return 0;
 
-		c->x.image = xcb_image_create_native(c->conn, w, h,
-				XCB_IMAGE_FORMAT_Z_PIXMAP, c->scr->root_depth, c->px,
-				w*h*4, (uint8_t*)c->px);
+	found = 0;
+
+	for (screens = xcb_render_query_pict_formats_screens_iterator(formats);
+			!found && screens.rem; xcb_render_pictscreen_next(&screens)) {
+		for (depths = xcb_render_pictscreen_depths_iterator(screens.data);
+				!found && depths.rem; xcb_render_pictdepth_next(&depths)) {
+			for (visuals = xcb_render_pictdepth_visuals_iterator(depths.data);
+					!found && visuals.rem; xcb_render_pictvisual_next(&visuals)) {
+				if (visuals.data->visual == visual) {
+					*format = visuals.data->format;
+					found = 1;
+				}
+			}
+		}
 	}
-}
 
-static void
-__canvas_keep_visible(Canvas_t *c)
-{
-	c->pos.x = CLAMP(c->pos.x, -c->width, c->viewport_width);
-	c->pos.y = CLAMP(c->pos.y, -c->height, c->viewport_height);
+	free(formats);
+
+	return found;
 }
 
-extern Canvas_t *
-canvas_load(xcb_connection_t *conn, xcb_window_t win, const char *path)
+static size_t
+__shm_size_class(size_t size)
 {
-	int x, y, w, h;
-	xcb_screen_t *scr;
-	unsigned char *px;
-	Canvas_t *c;
+	size_t step;
 
-	px = stbi_load(path, &w, &h, NULL, 4);
+	/* four classes per power of two, so a segment */
+	/* wastes at most a quarter of its size */
+	for (step = 64*1024; step * 8 <= size; step *= 2)
+		;
 
-	if (NULL == px)
-		return NULL;
+	return (size + step - 1) / step * step;
+}
 
-	scr = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+static void
+__shm_destroy(Canvas_t *c, struct ShmSegment *s)
+{
+	xcb_shm_detach(c->conn, s->seg);
 
-	if (NULL == scr)
-		die("can't get default screen");
+	if (s->memfd)
+		munmap(s->addr, s->size);
+	else
+		shmdt(s->addr);
 
-	c = xcalloc(1, sizeof(Canvas_t));
+	memset(s, 0, sizeof(*s));
+}
 
-	c->conn = conn;
-	c->win = win;
-	c->scr = scr;
-	c->viewport_width = w;
-	c->viewport_height = h;
+static int
+__shm_create_memfd(Canvas_t *c, struct ShmSegment *s)
+{
+	xcb_generic_error_t *error;
+	size_t size;
+	void *addr;
+	int fd;
+
+	addr = MAP_FAILED;
+
+	/* explicit huge pages only work if some were reserved, */
+	/* so they are tried first and given up on silently */
+	if (s->size >= SHM_HUGE_PAGE_SIZE &&
+			(fd = memfd_create("xcandb", MFD_CLOEXEC | MFD_HUGETLB)) >= 0) {
+		size = (s->size + SHM_HUGE_PAGE_SIZE - 1) /
+			SHM_HUGE_PAGE_SIZE * SHM_HUGE_PAGE_SIZE;
+		if (ftruncate(fd, size) == 0)
+			addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (addr == MAP_FAILED)
+			close(fd);
+		else
+			s->size = size;
+	}
 
-	c->gc = xcb_generate_id(conn);
-	c->shm = __x_check_mit_shm_extension(conn) ? 1 : 0;
+	if (addr == MAP_FAILED) {
+		if ((fd = memfd_create("xcandb", MFD_CLOEXEC)) < 0)
+			return -1;
 
-	xcb_create_gc(conn, c->gc, win, 0, NULL);
+		if (ftruncate(fd, s->size) < 0 || MAP_FAILED == (addr = mmap(NULL,
+						s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0))) {
+			close(fd);
+			return -1;
+		}
 
-	__canvas_set_size(c, w, h);
+		/* transparent huge pages, if shmem_enabled allows them */
+		madvise(addr, s->size, MADV_HUGEPAGE);
+	}
 
-	for (y = 0; y < h; ++y)
-		for (x = 0; x < w; ++x)
-			c->px[y*w+x] = __pack_color(&px[(y*w+x)*4]);
+	/* xcb closes the fd once it's sent */
+	error = xcb_request_check(c->conn,
+			xcb_shm_attach_fd_checked(c->conn, s->seg, fd, 0));
+
+	/* a server that refuses one fd refuses them all, */
+	/* later segments go straight to sysv */
+	if (NULL != error) {
+		free(error);
+		munmap(addr, s->size);
+		c->shm_fd = 0;
+		return -1;
+	}
 
-	free(px);
+	s->addr = addr;
+	s->memfd = 1;
 
-	return c;
+	return 0;
 }
 
-extern void
-canvas_save(Canvas_t *c, const char *path)
+static void
+__shm_create_sysv(Canvas_t *c, struct ShmSegment *s)
 {
-	unsigned char *px;
-	int x, y;
+	s->id = shmget(IPC_PRIVATE, s->size, IPC_CREAT | 0600);
 
-	px = xmalloc(c->width*c->height*4);
+	if (s->id < 0)
+		die("shmget:");
 
-	for (y = 0; y < c->height; ++y)
-		for (x = 0; x < c->width; ++x)
-			__unpack_color(c->px[y*c->width+x], &px[(y*c->width+x)*4]);
-
-	if (NULL != strstr(path, ".jpg") || NULL != strstr(path, ".jpeg")) {
-		stbi_write_jpg(path, c->width, c->height, 4, px, 100);
-	} else if (NULL != strstr(path, ".bmp")) {
-		stbi_write_bmp(path, c->width, c->height, 4, px);
-	} else if (NULL != strstr(path, ".tga")) {
-		stbi_write_tga(path, c->width, c->height, 4, px);
-	} else {
-		stbi_write_png(path, c->width, c->height, 4, px, c->width * 4);
+	s->addr = shmat(s->id, NULL, 0);
+
+	if (s->addr == (void *) -1) {
+		shmctl(s->id, IPC_RMID, NULL);
+		die("shmat:");
 	}
 
-	free(px);
+	xcb_shm_attach(c->conn, s->seg, s->id, 0);
+	shmctl(s->id, IPC_RMID, NULL);
 }
 
-extern void
-canvas_crop(Canvas_t *c, int x, int y, int w, int h)
+static void
+__shm_trim(Canvas_t *c)
 {
-	int dy;
-	uint32_t *crop_area;
+	struct ShmSegment *largest;
+	size_t free_bytes, limit;
+	int i;
+
+	/* enough to keep two canvas sized buffers around */
+	limit = (size_t)c->stride * c->buf.height * 4 * 2;
+
+	while (1) {
+		free_bytes = 0;
+		largest = NULL;
+
+		for (i = 0; i < SHM_POOL_SEGMENTS; ++i) {
+			if (NULL == c->pool[i].addr || c->pool[i].used)
+				continue;
+			free_bytes += c->pool[i].size;
+			if (NULL == largest || c->pool[i].size > largest->size)
+				largest = &c->pool[i];
+		}
 
-	if (x < 0) w += x, x = 0;
-	if (y < 0) h += y, y = 0;
-	if (x + w >= c->width) w = c->width - x;
-	if (y + h >= c->height) h = c->height - y;
+		if (free_bytes <= limit)
+			break;
 
-	if (w < 1 || h < 1 || (w == c->width && h == c->height))
-		return;
+		__shm_destroy(c, largest);
+	}
+}
+
+static struct ShmSegment *
+__shm_acquire(Canvas_t *c, size_t size)
+{
+	struct ShmSegment *s, *best, *empty, *largest;
+	int i;
+
+	best = empty = largest = NULL;
+
+	for (i = 0; i < SHM_POOL_SEGMENTS; ++i) {
+		s = &c->pool[i];
+		if (NULL == s->addr) {
+			if (NULL == empty)
+				empty = s;
+		} else if (!s->used) {
+			if (s->size >= size && s->size / 2 <= size &&
+					(NULL == best || s->size < best->size))
+				best = s;
+			if (NULL == largest || s->size > largest->size)
+				largest = s;
+		}
+	}
 
-	crop_area = xmalloc(4*w*h);
+	if (NULL != best) {
+		best->used = 1;
+		return best;
+	}
 
-	for (dy = 0; dy < h; ++dy) {
-		memcpy(
-			&crop_area[dy*w],
-			&c->px[(y+dy)*c->width+x],
-			4*w
-		);
+	if (NULL == empty) {
+		if (NULL == largest)
+			die("shm pool exhausted");
+		__shm_destroy(c, largest);
+		empty = largest;
 	}
 
-	__canvas_set_size(c, w, h);
-	canvas_move_relative(c, x, y);
+	s = empty;
+	s->size = __shm_size_class(size);
+	s->seg = xcb_generate_id(c->conn);
 
-	memcpy(c->px, crop_area, w*h*4);
-	free(crop_area);
+	/* sysv segments are capped by shmmax/shmall, memfd isn't */
+	if (!c->shm_fd || __shm_create_memfd(c, s) < 0)
+		__shm_create_sysv(c, s);
+
+	s->used = 1;
+
+	return s;
 }
 
-extern void
-canvas_grayscale(Canvas_t *c, int x, int y, int w, int h)
+static void
+__shm_release(Canvas_t *c, struct ShmSegment *s)
 {
-	for (int cy = y; cy < (y+h); ++cy) {
-		if (cy < 0 || cy >= c->height) continue;
-		for (int cx = x; cx < (x+w); ++cx) {
-			if (cx < 0 || cx >= c->width) continue;
-			uint32_t col = c->px[cy*c->width+cx];
-			int gray = ((col & 0xff) + ((col >> 8) & 0xff) + ((col >> 16) & 0xff)) / 3;
-			c->px[cy*c->width+cx] = (gray) | (gray << 8) | (gray << 16);
-		}
-	}
+	s->used = 0;
+	__shm_trim(c);
 }
 
-extern void
-canvas_blur(Canvas_t *c, int x, int y, int w, int h, int strength)
+/* only for buffers that are put to the server, scratch */
+/* the cpu alone works on is plain heap memory */
+static void *
+__canvas_scratch_alloc(Canvas_t *c, size_t size, struct ShmSegment **seg)
 {
-	int dx, dy;
-	int pass;
-	int numpx, r, g, b, kdx, kdy;
-	uint32_t *blur_area, *blur_area_previous, *tmp;
+	if (!c->shm) {
+		*seg = NULL;
+		return xmalloc(size);
+	}
 
-	if (x < 0) w += x, x = 0;
-	if (y < 0) h += y, y = 0;
-	if (x + w >= c->width) w = c->width - x;
-	if (y + h >= c->height) h = c->height - y;
+	*seg = __shm_acquire(c, size);
 
-	if (w < 1 || h < 1)
-		return;
+	return (*seg)->addr;
+}
 
-	blur_area          = xmalloc(4*w*h);
-	blur_area_previous = xmalloc(4*w*h);
-
-	for (dy = 0; dy < h; ++dy) {
-		memcpy(
-			&blur_area[dy*w],
-			&c->px[(y+dy)*c->width+x],
-			4*w
-		);
-	}
-
-	for (pass = 0; pass < strength; ++pass) {
-		tmp = blur_area_previous;
-		blur_area_previous = blur_area;
-		blur_area = tmp;
-
-		for (dy = 0; dy < h; ++dy) {
-			for (dx = 0; dx < w; ++dx) {
-				numpx = r = g = b = 0;
-				for (kdy = -3; kdy < 4; ++kdy) {
-					if ((dy+kdy) < 0 || (dy+kdy) >= h) continue;
-					for (kdx = -3; kdx < 4; ++kdx) {
-						if ((dx+kdx) < 0 || (dx+kdx) >= w) continue;
-						r += RED(blur_area_previous[(dy+kdy)*w+dx+kdx]);
-						g += GREEN(blur_area_previous[(dy+kdy)*w+dx+kdx]);
-						b += BLUE(blur_area_previous[(dy+kdy)*w+dx+kdx]);
-						numpx++;
-					}
-				}
-				blur_area[dy*w+dx] = ((blur_area[dy*w+dx])&0xff000000) |
-									 ((r/numpx)<<16) |
-									 ((g/numpx)<<8) |
-									 (b/numpx);
-			}
-		}
+static void
+__canvas_scratch_free(Canvas_t *c, void *p, struct ShmSegment *seg)
+{
+	if (NULL != seg)
+		__shm_release(c, seg);
+	else
+		free(p);
+}
+
+static void
+__canvas_xrender_drop_src(Canvas_t *c)
+{
+	/* the picture goes away with the pixmap under it */
+	if (c->xrender.src) {
+		xcb_render_free_picture(c->conn, c->xrender.src);
+		c->xrender.src = XCB_NONE;
+	}
+
+	if (c->xrender.pixmap) {
+		xcb_free_pixmap(c->conn, c->xrender.pixmap);
+		c->xrender.pixmap = XCB_NONE;
 	}
+}
+
+static size_t ram_budget;
 
-	for (dy = 0; dy < h; ++dy) {
-		memcpy(
-			&c->px[(y+dy)*c->width+x],
-			&blur_area[dy*w],
-			4*w
-		);
+static size_t
+__ram_budget(void)
+{
+	long pages, page_size;
+
+	/* half the memory there is, unless told otherwise */
+	if (ram_budget == 0) {
+		pages = sysconf(_SC_PHYS_PAGES);
+		page_size = sysconf(_SC_PAGESIZE);
+		ram_budget = pages > 0 && page_size > 0 ?
+			(size_t)pages * page_size / 2 : SIZE_MAX;
 	}
 
-	free(blur_area);
-	free(blur_area_previous);
+	return ram_budget;
 }
 
-extern void
-canvas_move_relative(Canvas_t *c, int offx, int offy)
+static void *
+__pixels_alloc(size_t size, int *mapped)
 {
-	c->pos.x += offx;
-	c->pos.y += offy;
+	char path[PATH_MAX];
+	const char *dir;
+	void *addr;
+	int fd;
 
-	__canvas_keep_visible(c);
+	*mapped = size > __ram_budget();
+
+	if (!*mapped)
+		return xmalloc(size);
+
+	/* pages of a file mapping can always be written back */
+	/* and dropped, anonymous memory would need swap */
+	if (NULL == (dir = getenv("TMPDIR")))
+		dir = "/tmp";
+
+	snprintf(path, sizeof(path), "%s/xcandb.XXXXXX", dir);
+
+	if ((fd = mkstemp(path)) < 0)
+		die("mkstemp:");
+
+	unlink(path);
+
+	if (ftruncate(fd, size) < 0)
+		die("ftruncate:");
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (addr == MAP_FAILED)
+		die("mmap:");
+
+	return addr;
 }
 
-extern void
-canvas_set_viewport(Canvas_t *c, int vw, int vh)
+static void
+__pixels_free(void *px, size_t size, int mapped)
 {
-	c->pos.x += ((float)vw - c->viewport_width) / 2;
-	c->pos.y += ((float)vh - c->viewport_height) / 2;
+	if (mapped)
+		munmap(px, size);
+	else
+		free(px);
+}
 
-	c->viewport_width = vw;
-	c->viewport_height = vh;
+static void
+__paging_reset(Canvas_t *c)
+{
+	free(c->paging.stamp);
+	c->paging.stamp = NULL;
+	c->paging.resident = 0;
 
-	__canvas_keep_visible(c);
+	if (!c->buf.mapped)
+		return;
+
+	c->paging.nbands = (c->buf.height + PAGING_BAND_ROWS - 1) / PAGING_BAND_ROWS;
+	c->paging.stamp = xcalloc(c->paging.nbands, sizeof(unsigned));
 }
 
-extern void
-canvas_render(Canvas_t *c)
+static void
+__paging_evict(Canvas_t *c, int band)
 {
-	if (c->pos.y > 0)
-		xcb_clear_area(c->conn, 0, c->win, 0, 0, c->viewport_width, c->pos.y);
+	uintptr_t start, end, page;
+
+	page = sysconf(_SC_PAGESIZE);
+	start = (uintptr_t)&c->buf.px[(size_t)band*PAGING_BAND_ROWS*c->stride];
+	end = (uintptr_t)&c->buf.px[(size_t)MIN((band + 1)*PAGING_BAND_ROWS,
+			c->buf.height)*c->stride];
+
+	/* only whole pages, the ones shared with a neighbour stay */
+	start = (start + page - 1) / page * page;
+	end = end / page * page;
+
+	if (start < end)
+#ifdef MADV_PAGEOUT
+		madvise((void *)start, end - start, MADV_PAGEOUT);
+#else
+		madvise((void *)start, end - start, MADV_DONTNEED);
+#endif
+
+	c->paging.stamp[band] = 0;
+	c->paging.resident--;
+}
 
-	if (c->pos.y + c->height < c->viewport_height)
-		xcb_clear_area(c->conn, 0, c->win, 0, c->pos.y + c->height,
-				c->viewport_width, c->viewport_height - (c->pos.y + c->height));
+static void
+__paging_enforce(Canvas_t *c)
+{
+	size_t band_size;
+	int i, lru;
 
-	if (c->pos.x > 0)
-		xcb_clear_area(c->conn, 0, c->win, 0, 0, c->pos.x, c->viewport_height);
+	if (!c->buf.mapped)
+		return;
 
-	if (c->pos.x + c->width < c->viewport_width)
-		xcb_clear_area(c->conn, 0, c->win, c->pos.x + c->width, 0,
-				c->viewport_width - (c->pos.x + c->width), c->viewport_height);
+	band_size = (size_t)PAGING_BAND_ROWS*c->stride*4;
+
+	/* the bands touched last are never evicted */
+	while ((size_t)c->paging.resident * band_size > __ram_budget()) {
+		lru = -1;
+		for (i = 0; i < c->paging.nbands; ++i)
+			if (c->paging.stamp[i] && c->paging.stamp[i] != c->paging.tick &&
+					(lru < 0 || c->paging.stamp[i] < c->paging.stamp[lru]))
+				lru = i;
+		if (lru < 0)
+			break;
+		__paging_evict(c, lru);
+	}
+}
 
-	if (c->shm) {
-		xcb_copy_area(c->conn, c->x.shm.pixmap, c->win,
-				c->gc, 0, 0, c->pos.x, c->pos.y, c->width, c->height);
-	} else {
-		xcb_image_put(c->conn, c->win, c->gc,
-				c->x.image, c->pos.x, c->pos.y, 0);
+static void
+__paging_touch(Canvas_t *c, int y, int h)
+{
+	int band;
+
+	if (!c->buf.mapped || h < 1)
+		return;
+
+	/* canvas to buffer rows */
+	y += c->buf.y;
+	++c->paging.tick;
+
+	for (band = MAX(y, 0) / PAGING_BAND_ROWS;
+			band <= MIN(y + h - 1, c->buf.height - 1) / PAGING_BAND_ROWS; ++band) {
+		if (!c->paging.stamp[band])
+			c->paging.resident++;
+		c->paging.stamp[band] = c->paging.tick;
 	}
 
-	xcb_flush(c->conn);
+	__paging_enforce(c);
 }
 
-extern void
-canvas_viewport_to_canvas_pos(Canvas_t *c, int x, int y, int *out_x, int *out_y)
+static void
+__paging_scanned(Canvas_t *c)
 {
-	*out_x = x - c->pos.x;
-	*out_y = y - c->pos.y;
+	int band;
+
+	if (!c->buf.mapped)
+		return;
+
+	/* a pass over the whole buffer faulted every band in, */
+	/* none of them more recent than what the view touched */
+	++c->paging.tick;
+
+	for (band = 0; band < c->paging.nbands; ++band) {
+		if (!c->paging.stamp[band])
+			c->paging.resident++;
+		c->paging.stamp[band] = c->paging.tick;
+	}
+
+	++c->paging.tick;
+	__paging_enforce(c);
 }
 
-extern void
-canvas_free(Canvas_t *c)
+static void
+__canvas_free_buffer(Canvas_t *c)
 {
-	xcb_free_gc(c->conn, c->gc);
+	__canvas_xrender_drop_src(c);
 
 	if (c->shm) {
-		shmctl(c->x.shm.id, IPC_RMID, NULL);
-		xcb_shm_detach(c->conn, c->x.shm.seg);
-		shmdt(c->px);
 		xcb_free_pixmap(c->conn, c->x.shm.pixmap);
+		__shm_release(c, c->x.shm.seg);
+	} else {
+		__pixels_free(c->buf.px, c->buf.size, c->buf.mapped);
+	}
+
+	free(c->paging.stamp);
+}
+
+static void
+__canvas_set_size(Canvas_t *c, int w, int h)
+{
+	c->width = c->stride = w;
+	c->height = c->buf.height = h;
+	c->buf.x = c->buf.y = 0;
+
+	if (c->shm) {
+		c->x.shm.seg = __shm_acquire(c, (size_t)w*h*4);
+		c->x.shm.pixmap = xcb_generate_id(c->conn);
+		c->buf.px = c->x.shm.seg->addr;
+
+		xcb_shm_create_pixmap(c->conn, c->x.shm.pixmap, c->win, w, h,
+				c->scr->root_depth, c->x.shm.seg->seg, 0);
 	} else {
-		xcb_image_destroy(c->x.image);
+		c->buf.size = (size_t)w*h*4;
+		c->buf.px = __pixels_alloc(c->buf.size, &c->buf.mapped);
 	}
 
+	c->px = c->buf.px;
+	__paging_reset(c);
+}
+
+static void
+__canvas_compact(Canvas_t *c)
+{
+	struct ShmSegment *seg;
+	xcb_pixmap_t pixmap;
+	uint32_t *px, *old;
+	size_t size;
+	int y, stride;
+
+	if (c->shm) {
+		seg = c->x.shm.seg;
+		pixmap = c->x.shm.pixmap;
+		px = c->px;
+		stride = c->stride;
+
+		__canvas_xrender_drop_src(c);
+		__canvas_set_size(c, c->width, c->height);
+
+		for (y = 0; y < c->height; ++y)
+			memcpy(&c->px[(size_t)y*c->stride], &px[(size_t)y*stride], 4*c->width);
+
+		xcb_free_pixmap(c->conn, pixmap);
+		__shm_release(c, seg);
+	} else if (c->buf.mapped) {
+		/* the cropped image may fit in memory now */
+		px = c->px;
+		stride = c->stride;
+		old = c->buf.px;
+		size = c->buf.size;
+
+		__canvas_set_size(c, c->width, c->height);
+
+		for (y = 0; y < c->height; ++y)
+			memcpy(&c->px[(size_t)y*c->stride], &px[(size_t)y*stride], 4*c->width);
+
+		__pixels_free(old, size, 1);
+		__paging_scanned(c);
+	} else {
+		/* rows only move towards the start, so it can be done in place */
+		for (y = 0; y < c->height; ++y)
+			memmove(&c->buf.px[(size_t)y*c->width], &c->px[(size_t)y*c->stride], 4*c->width);
+
+		c->buf.size = (size_t)c->width*c->height*4;
+		c->buf.px = xrealloc(c->buf.px, c->buf.size);
+		c->px = c->buf.px;
+		c->stride = c->width;
+		c->buf.height = c->height;
+		c->buf.x = c->buf.y = 0;
+	}
+}
+
+static void
+__canvas_put_tiles(Canvas_t *c, xcb_drawable_t dst, const uint32_t *px,
+		int stride, int dx, int dy, int w, int h)
+{
+	int tx, ty, tw, th, row;
+	const uint32_t *src;
+
+	/* only the destination goes over the wire, the source */
+	/* may be anywhere in client memory */
+	for (ty = 0; ty < h; ty += c->x.put.tile_rows) {
+		th = MIN(c->x.put.tile_rows, h - ty);
+		for (tx = 0; tx < w; tx += TILE_SIZE) {
+			tw = MIN(TILE_SIZE, w - tx);
+			src = &px[(size_t)ty*stride+tx];
+
+			for (row = 0; row < th; ++row)
+				memcpy(&c->x.put.tile[row*tw], &src[(size_t)row*stride], tw*4);
+
+			xcb_put_image(c->conn, XCB_IMAGE_FORMAT_Z_PIXMAP, dst,
+					c->gc, tw, th, dx + tx, dy + ty, 0,
+					c->scr->root_depth, tw*th*4, (const uint8_t *)c->x.put.tile);
+		}
+	}
+}
+
+static void
+__canvas_origin(const Canvas_t *c, int *x, int *y)
+{
+	/* floor, truncating would shift negative positions */
+	/* by a pixel relative to positive ones */
+	*x = floorf(c->pos.x);
+	*y = floorf(c->pos.y);
+}
+
+static void
+__canvas_damage_all(Canvas_t *c)
+{
+	c->damage.count = 0;
+	canvas_damage(c, 0, 0, c->viewport_width, c->viewport_height);
+}
+
+static int
+__canvas_scaled(const Canvas_t *c, int v)
+{
+	return MAX(1, (int)(v * c->zoom + 0.5f));
+}
+
+static void
+__canvas_damage_area(Canvas_t *c, int x, int y, int w, int h)
+{
+	int ox, oy, x0, y0, x1, y1;
+
+	__canvas_origin(c, &ox, &oy);
+
+	/* a pixel more on each side, filtering spreads edits */
+	x0 = floorf(x * c->zoom) - 1;
+	y0 = floorf(y * c->zoom) - 1;
+	x1 = ceilf((x + w) * c->zoom) + 1;
+	y1 = ceilf((y + h) * c->zoom) + 1;
+
+	canvas_damage(c, ox + x0, oy + y0, x1 - x0, y1 - y0);
+}
+
+static int
+__area_empty(struct Area a)
+{
+	return a.x0 >= a.x1 || a.y0 >= a.y1;
+}
+
+static struct Area
+__area_intersect(struct Area a, struct Area b)
+{
+	return (struct Area) {
+		MAX(a.x0, b.x0), MAX(a.y0, b.y0),
+		MIN(a.x1, b.x1), MIN(a.y1, b.y1)
+	};
+}
+
+static struct Area
+__area_union(struct Area a, struct Area b)
+{
+	if (__area_empty(a)) return b;
+	if (__area_empty(b)) return a;
+
+	return (struct Area) {
+		MIN(a.x0, b.x0), MIN(a.y0, b.y0),
+		MAX(a.x1, b.x1), MAX(a.y1, b.y1)
+	};
+}
+
+static struct Area
+__op_window(const struct HistoryStep *op, struct Area need)
+{
+	struct Area area, win;
+
+	/* what the op reads to get need right: a blur pass */
+	/* moves edges IMAGE_BLUR_RADIUS pixels in, so whatever is */
+	/* wrong at the border of a wider window never makes it */
+	area = (struct Area) { op->x, op->y, op->x + op->width, op->y + op->height };
+	win = __area_intersect(need, area);
+
+	if (op->op == OP_BLUR && !__area_empty(win)) {
+		win.x0 -= IMAGE_BLUR_RADIUS * op->strength;
+		win.y0 -= IMAGE_BLUR_RADIUS * op->strength;
+		win.x1 += IMAGE_BLUR_RADIUS * op->strength;
+		win.y1 += IMAGE_BLUR_RADIUS * op->strength;
+		win = __area_intersect(win, area);
+	}
+
+	return win;
+}
+
+static void
+__ops_eval(Canvas_t *c, struct Area t)
+{
+	struct HistoryStep *st;
+	struct Area *need, s, w;
+	uint32_t *px, *p;
+	int i, n, sw, y;
+
+	/* walk the ops backwards to find what each has to */
+	/* produce, then run them forwards over just that */
+	n = c->history.pos;
+	need = xmalloc(sizeof(struct Area) * (n + 1));
+	need[n] = t;
+
+	for (i = n - 1; i >= 0; --i) {
+		st = &c->history.steps[i];
+		need[i] = need[i+1];
+		if (st->type == STEP_OP)
+			need[i] = __area_union(need[i], __op_window(st, need[i+1]));
+	}
+
+	s = need[0];
+	sw = s.x1 - s.x0;
+	px = xmalloc((size_t)sw*(s.y1-s.y0)*4);
+
+	for (y = s.y0; y < s.y1; ++y)
+		memcpy(&px[(size_t)(y-s.y0)*sw], &c->ops.src[(size_t)y*c->stride+s.x0], 4*sw);
+
+	for (i = 0; i < n; ++i) {
+		st = &c->history.steps[i];
+
+		if (st->type != STEP_OP)
+			continue;
+
+		w = __op_window(st, need[i+1]);
+
+		if (__area_empty(w))
+			continue;
+
+		p = &px[(size_t)(w.y0-s.y0)*sw+w.x0-s.x0];
+
+		if (st->op == OP_BLUR) {
+			if (image_blur_pixels(p, sw, w.x1 - w.x0, w.y1 - w.y0, st->strength) < 0)
+				die("OOM");
+		} else
+			image_grayscale_pixels(p, sw, w.x1 - w.x0, w.y1 - w.y0);
+	}
+
+	for (y = t.y0; y < t.y1; ++y)
+		memcpy(&c->buf.px[(size_t)y*c->stride+t.x0],
+				&px[(size_t)(y-s.y0)*sw+t.x0-s.x0], 4*(t.x1-t.x0));
+
+	free(px);
+	free(need);
+}
+
+static void
+__ops_update(Canvas_t *c, int x, int y, int w, int h)
+{
+	int tx, ty, tx0, tx1, ty0, ty1, run;
+
+	if (!c->ops.enabled || w < 1 || h < 1)
+		return;
+
+	/* canvas to buffer coordinates */
+	x += c->buf.x;
+	y += c->buf.y;
+
+	tx0 = MAX(x, 0) / TILE_SIZE; tx1 = MIN((x + w - 1) / TILE_SIZE, c->ops.cols - 1);
+	ty0 = MAX(y, 0) / TILE_SIZE; ty1 = MIN((y + h - 1) / TILE_SIZE, c->ops.rows - 1);
+
+	/* neighbouring stale tiles are evaluated together, */
+	/* so blurs across them don't pay for their halo twice */
+	for (ty = ty0; ty <= ty1; ++ty) {
+		for (tx = tx0; tx <= tx1; ++tx) {
+			if (c->ops.valid[ty*c->ops.cols+tx])
+				continue;
+
+			for (run = tx; tx <= tx1 && !c->ops.valid[ty*c->ops.cols+tx]; ++tx)
+				c->ops.valid[ty*c->ops.cols+tx] = 1;
+
+			__ops_eval(c, (struct Area) {
+				run * TILE_SIZE, ty * TILE_SIZE,
+				MIN(tx * TILE_SIZE, c->stride),
+				MIN((ty + 1) * TILE_SIZE, c->buf.height)
+			});
+		}
+	}
+}
+
+static void
+__ops_flush(Canvas_t *c)
+{
+	struct Area view;
+	int tx, ty, stale;
+
+	/* everything stale in the view in one go, no halos */
+	view.x0 = c->buf.x / TILE_SIZE * TILE_SIZE;
+	view.y0 = c->buf.y / TILE_SIZE * TILE_SIZE;
+	view.x1 = MIN((c->buf.x + c->width + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE, c->stride);
+	view.y1 = MIN((c->buf.y + c->height + TILE_SIZE - 1) / TILE_SIZE * TILE_SIZE, c->buf.height);
+
+	stale = 0;
+
+	for (ty = view.y0 / TILE_SIZE; ty * TILE_SIZE < view.y1; ++ty) {
+		for (tx = view.x0 / TILE_SIZE; tx * TILE_SIZE < view.x1; ++tx) {
+			stale |= !c->ops.valid[ty*c->ops.cols+tx];
+			c->ops.valid[ty*c->ops.cols+tx] = 1;
+		}
+	}
+
+	if (stale)
+		__ops_eval(c, view);
+}
+
+static inline uint32_t
+__avg4(uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+	uint32_t rb, ag;
+
+	/* two channels per word, the sums fit in 10 bits */
+	rb = (a & 0x00ff00ff) + (b & 0x00ff00ff) +
+		(c & 0x00ff00ff) + (d & 0x00ff00ff) + 0x00020002;
+	ag = (a >> 8 & 0x00ff00ff) + (b >> 8 & 0x00ff00ff) +
+		(c >> 8 & 0x00ff00ff) + (d >> 8 & 0x00ff00ff) + 0x00020002;
+
+	return (rb >> 2 & 0x00ff00ff) | (ag << 6 & 0xff00ff00);
+}
+
+static inline uint32_t
+__lerp(uint32_t a, uint32_t b, uint32_t w)
+{
+	uint32_t rb, ag;
+
+	/* w goes from 0 to 256, products fit in 16 bits per channel */
+	rb = (a & 0x00ff00ff) * (256 - w) + (b & 0x00ff00ff) * w;
+	ag = (a >> 8 & 0x00ff00ff) * (256 - w) + (b >> 8 & 0x00ff00ff) * w;
+
+	return (rb >> 8 & 0x00ff00ff) | (ag & 0xff00ff00);
+}
+
+static void
+__mip_free(Canvas_t *c)
+{
+	int k;
+
+	for (k = 1; k < MIP_LEVELS; ++k) {
+		free(c->mip[k].px);
+		free(c->mip[k].dirty);
+		c->mip[k].px = NULL;
+		c->mip[k].dirty = NULL;
+	}
+}
+
+static void
+__mip_source(const Canvas_t *c, int k, const uint32_t **px, int *stride,
+		int *w, int *h)
+{
+	if (k == 0) {
+		*px = c->px; *stride = c->stride;
+		*w = c->width; *h = c->height;
+	} else {
+		*px = c->mip[k].px; *stride = c->mip[k].width;
+		*w = c->mip[k].width; *h = c->mip[k].height;
+	}
+}
+
+static void
+__mip_invalidate(Canvas_t *c, int x, int y, int w, int h)
+{
+	struct MipLevel *l;
+	int k, tx, ty;
+
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	w = MIN(x + w, c->width) - x;
+	h = MIN(y + h, c->height) - y;
+
+	if (w < 1 || h < 1)
+		return;
+
+	for (k = 1; k < MIP_LEVELS && NULL != c->mip[k].px; ++k) {
+		l = &c->mip[k];
+		for (ty = (y >> k) / TILE_SIZE; ty <= ((y + h - 1) >> k) / TILE_SIZE; ++ty)
+			for (tx = (x >> k) / TILE_SIZE; tx <= ((x + w - 1) >> k) / TILE_SIZE; ++tx)
+				l->dirty[ty*l->cols+tx] = 1;
+	}
+}
+
+static void
+__mip_update(Canvas_t *c, int k, int x0, int y0, int x1, int y1)
+{
+	struct MipLevel *l;
+	const uint32_t *src, *r0, *r1;
+	uint32_t *dst;
+	int sw, sh, stride, rows;
+	int tx, ty, x, y, xa, xb, tx0, ty0, tx1, ty1;
+
+	/* level 0 is the buffer, which in edit list mode */
+	/* may still have to be evaluated there */
+	if (k == 0) {
+		__paging_touch(c, y0, y1 - y0);
+		__ops_update(c, x0, y0, x1 - x0, y1 - y0);
+		return;
+	}
+
+	l = &c->mip[k];
+
+	if (NULL == l->px) {
+		__mip_update(c, k - 1, 0, 0, 0, 0);
+		__mip_source(c, k - 1, &src, &stride, &sw, &sh);
+		l->width = (sw + 1) / 2;
+		l->height = (sh + 1) / 2;
+		l->cols = (l->width + TILE_SIZE - 1) / TILE_SIZE;
+		rows = (l->height + TILE_SIZE - 1) / TILE_SIZE;
+		l->px = xmalloc((size_t)l->width*l->height*4);
+		l->dirty = xmalloc(l->cols*rows);
+		memset(l->dirty, 1, l->cols*rows);
+	}
+
+	x0 = MAX(x0, 0); x1 = MIN(x1, l->width);
+	y0 = MAX(y0, 0); y1 = MIN(y1, l->height);
+
+	for (ty = y0 / TILE_SIZE; ty * TILE_SIZE < y1; ++ty) {
+		for (tx = x0 / TILE_SIZE; tx * TILE_SIZE < x1; ++tx) {
+			if (!l->dirty[ty*l->cols+tx])
+				continue;
+
+			tx0 = tx * TILE_SIZE; tx1 = MIN(tx0 + TILE_SIZE, l->width);
+			ty0 = ty * TILE_SIZE; ty1 = MIN(ty0 + TILE_SIZE, l->height);
+
+			/* the level below has to be current under this tile */
+			__mip_update(c, k - 1, 2*tx0, 2*ty0, 2*tx1, 2*ty1);
+			__mip_source(c, k - 1, &src, &stride, &sw, &sh);
+
+			for (y = ty0; y < ty1; ++y) {
+				r0 = &src[(size_t)(2*y)*stride];
+				r1 = &src[(size_t)MIN(2*y + 1, sh - 1)*stride];
+				dst = &l->px[(size_t)y*l->width];
+				for (x = tx0; x < tx1; ++x) {
+					xa = 2*x; xb = MIN(xa + 1, sw - 1);
+					dst[x] = __avg4(r0[xa], r0[xb], r1[xa], r1[xb]);
+				}
+			}
+
+			l->dirty[ty*l->cols+tx] = 0;
+		}
+	}
+}
+
+static void
+__canvas_view_alloc(Canvas_t *c)
+{
+	if (NULL == c->view.px)
+		c->view.px = __canvas_scratch_alloc(c,
+				(size_t)c->frame.width*c->frame.height*4, &c->view.seg);
+}
+
+static void
+__canvas_view_free(Canvas_t *c)
+{
+	if (NULL != c->view.px)
+		__canvas_scratch_free(c, c->view.px, c->view.seg);
+	c->view.px = NULL;
+}
+
+static int *
+__canvas_sample_map(int v0, int n, int origin, float scale, int size)
+{
+	int *map, i, fx;
+
+	/* source index and weight of each output pixel, 8 bit fraction */
+	map = xmalloc(sizeof(int)*n*2);
+
+	for (i = 0; i < n; ++i) {
+		fx = floorf(((v0 + i - origin + 0.5f) / scale - 0.5f) * 256.0f);
+		if (fx < 0) fx = 0;
+		if (fx >= (size - 1) * 256) fx = (size - 1) * 256;
+		map[2*i] = fx >> 8;
+		map[2*i+1] = fx & 0xff;
+	}
+
+	return map;
+}
+
+static void
+__canvas_render_scaled(Canvas_t *c, int ox, int oy, int x0, int y0, int x1, int y1)
+{
+	const uint32_t *src, *r0, *r1;
+	uint32_t *out;
+	int *xmap, *ymap;
+	int k, w, h, sw, sh, stride, x, y, xa, xb, ya;
+	float scale;
+
+	/* sample the level closest above the zoom, so the */
+	/* bilinear filter never skips over source pixels */
+	for (k = 0; k + 1 < MIP_LEVELS && c->zoom * (2 << k) <= 1.0f; ++k)
+		;
+
+	scale = c->zoom * (1 << k);
+	w = x1 - x0;
+	h = y1 - y0;
+
+	__mip_update(c, k, 0, 0, 0, 0);
+	__mip_source(c, k, &src, &stride, &sw, &sh);
+
+	xmap = __canvas_sample_map(x0, w, ox, scale, sw);
+	ymap = __canvas_sample_map(y0, h, oy, scale, sh);
+
+	__mip_update(c, k, xmap[0], ymap[0], xmap[2*(w-1)] + 2, ymap[2*(h-1)] + 2);
+
+	__canvas_view_alloc(c);
+
+	for (y = 0; y < h; ++y) {
+		ya = ymap[2*y];
+		r0 = &src[(size_t)ya*stride];
+		r1 = &src[(size_t)MIN(ya + 1, sh - 1)*stride];
+		out = &c->view.px[(size_t)(y0+y)*c->frame.width+x0];
+		for (x = 0; x < w; ++x) {
+			xa = xmap[2*x];
+			xb = MIN(xa + 1, sw - 1);
+			out[x] = __lerp(__lerp(r0[xa], r0[xb], xmap[2*x+1]),
+					__lerp(r1[xa], r1[xb], xmap[2*x+1]), ymap[2*y+1]);
+		}
+	}
+
+	free(xmap);
+	free(ymap);
+
+	/* the view can be written again before the server read it, */
+	/* but only with pixels of a newer frame */
+	if (c->shm) {
+		xcb_shm_put_image(c->conn, c->frame.pixmap, c->gc,
+				c->frame.width, c->frame.height, x0, y0, w, h, x0, y0,
+				c->scr->root_depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 0,
+				c->view.seg->seg, 0);
+	} else {
+		__canvas_put_tiles(c, c->frame.pixmap,
+				&c->view.px[(size_t)y0*c->frame.width+x0], c->frame.width,
+				x0, y0, w, h);
+	}
+}
+
+static void
+__canvas_render_xrender(Canvas_t *c, int ox, int oy, int x0, int y0, int x1, int y1)
+{
+	xcb_render_fixed_t scale;
+	const char *filter;
+	xcb_pixmap_t pixmap;
+	int whole, sx0, sy0, sx1, sy1;
+
+	/* bilinear reads a pixel past the edges of the picture, */
+	/* so it must not reach what a crop left in the buffer */
+	whole = c->buf.x == 0 && c->buf.y == 0 &&
+		c->width == c->stride && c->height == c->buf.height;
+
+	if (c->xrender.src && (whole != !c->xrender.pixmap ||
+				c->xrender.width != c->width || c->xrender.height != c->height))
+		__canvas_xrender_drop_src(c);
+
+	if (!c->xrender.src) {
+		pixmap = c->x.shm.pixmap;
+
+		if (!whole) {
+			pixmap = c->xrender.pixmap = xcb_generate_id(c->conn);
+			xcb_create_pixmap(c->conn, c->scr->root_depth, pixmap, c->win,
+					c->width, c->height);
+		}
+
+		/* past its edges the picture repeats them */
+		c->xrender.src = xcb_generate_id(c->conn);
+		xcb_render_create_picture(c->conn, c->xrender.src, pixmap,
+				c->xrender.format, XCB_RENDER_CP_REPEAT,
+				(const uint32_t []) { XCB_RENDER_REPEAT_PAD });
+
+		c->xrender.width = c->width;
+		c->xrender.height = c->height;
+	}
+
+	/* the view pixmap is brought up to date where it's read */
+	if (c->xrender.pixmap) {
+		sx0 = MAX(0, (int)floorf((x0 - ox) / c->zoom) - 1);
+		sy0 = MAX(0, (int)floorf((y0 - oy) / c->zoom) - 1);
+		sx1 = MIN(c->width, (int)ceilf((x1 - ox) / c->zoom) + 1);
+		sy1 = MIN(c->height, (int)ceilf((y1 - oy) / c->zoom) + 1);
+		if (sx0 < sx1 && sy0 < sy1)
+			xcb_copy_area(c->conn, c->x.shm.pixmap, c->xrender.pixmap, c->gc,
+					c->buf.x + sx0, c->buf.y + sy0, sx0, sy0,
+					sx1 - sx0, sy1 - sy0);
+	}
+
+	if (!c->xrender.dst) {
+		c->xrender.dst = xcb_generate_id(c->conn);
+		xcb_render_create_picture(c->conn, c->xrender.dst, c->frame.pixmap,
+				c->xrender.format, 0, NULL);
+	}
+
+	/* whole magnifications are exact with nearest */
+	filter = c->zoom >= 1.0f && c->zoom == floorf(c->zoom) ? "nearest" : "bilinear";
+	scale = 65536.0f / c->zoom;
+
+	/* the translation is where x0, y0 lands in the picture, which */
+	/* is never further than its width, so 16.16 can hold it */
+	xcb_render_set_picture_filter(c->conn, c->xrender.src,
+			strlen(filter), filter, 0, NULL);
+	xcb_render_set_picture_transform(c->conn, c->xrender.src,
+			(xcb_render_transform_t) {
+				scale, 0, (x0 - ox) / c->zoom * 65536.0f,
+				0, scale, (y0 - oy) / c->zoom * 65536.0f,
+				0, 0, 65536
+			});
+	xcb_render_composite(c->conn, XCB_RENDER_PICT_OP_SRC, c->xrender.src,
+			XCB_NONE, c->xrender.dst, 0, 0, 0, 0, x0, y0, x1 - x0, y1 - y0);
+}
+
+static void
+__canvas_damage_outline(Canvas_t *c, const xcb_rectangle_t *r)
+{
+	/* one strip per edge, each a pixel longer than the side */
+	canvas_damage(c, r->x, r->y, r->width + 1, 1);
+	canvas_damage(c, r->x, r->y + r->height, r->width + 1, 1);
+	canvas_damage(c, r->x, r->y, 1, r->height + 1);
+	canvas_damage(c, r->x + r->width, r->y, 1, r->height + 1);
+}
+
+static void
+__canvas_clear(Canvas_t *c, int x0, int y0, int x1, int y1)
+{
+	if (x0 < x1 && y0 < y1)
+		xcb_poly_fill_rectangle(c->conn, c->frame.pixmap, c->frame.gc, 1,
+				(const xcb_rectangle_t []) {{ x0, y0, x1 - x0, y1 - y0 }});
+}
+
+static void
+__canvas_render_rect(Canvas_t *c, const xcb_rectangle_t *r)
+{
+	int rx0, ry0, rx1, ry1;
+	int ix0, iy0, ix1, iy1;
+	int x0, y0, x1, y1;
+	int cx0, cy0, cx1, cy1;
+
+	rx0 = r->x; rx1 = r->x + r->width;
+	ry0 = r->y; ry1 = r->y + r->height;
+
+	__canvas_origin(c, &ix0, &iy0);
+	ix1 = ix0 + __canvas_scaled(c, c->width);
+	iy1 = iy0 + __canvas_scaled(c, c->height);
+
+	x0 = MAX(rx0, ix0); x1 = MIN(rx1, ix1);
+	y0 = MAX(ry0, iy0); y1 = MIN(ry1, iy1);
+
+	/* the background above, below and at both sides of the image */
+	__canvas_clear(c, rx0, ry0, rx1, MIN(ry1, iy0));
+	__canvas_clear(c, rx0, MAX(ry0, iy1), rx1, ry1);
+	__canvas_clear(c, rx0, y0, MIN(rx1, ix0), y1);
+	__canvas_clear(c, MAX(rx0, ix1), y0, rx1, y1);
+
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	if (c->ops.enabled) {
+		cx0 = floorf((x0 - ix0) / c->zoom);
+		cy0 = floorf((y0 - iy0) / c->zoom);
+		cx1 = ceilf((x1 - ix0) / c->zoom) + 1;
+		cy1 = ceilf((y1 - iy0) / c->zoom) + 1;
+		__ops_update(c, cx0, cy0, cx1 - cx0, cy1 - cy0);
+	}
+
+	if (c->zoom != 1.0f) {
+		if (c->xrender.enabled)
+			__canvas_render_xrender(c, ix0, iy0, x0, y0, x1, y1);
+		else
+			__canvas_render_scaled(c, ix0, iy0, x0, y0, x1, y1);
+		return;
+	}
+
+	/* only the visible part of the image is sent, */
+	/* whatever its size and position */
+	if (c->shm) {
+		xcb_copy_area(c->conn, c->x.shm.pixmap, c->frame.pixmap, c->gc,
+				c->buf.x + x0 - ix0, c->buf.y + y0 - iy0,
+				x0, y0, x1 - x0, y1 - y0);
+	} else {
+		__paging_touch(c, y0 - iy0, y1 - y0);
+		__canvas_put_tiles(c, c->frame.pixmap,
+				&c->px[(size_t)(y0-iy0)*c->stride+x0-ix0], c->stride,
+				x0, y0, x1 - x0, y1 - y0);
+	}
+}
+
+static void
+__canvas_frame_resize(Canvas_t *c)
+{
+	if (c->frame.pixmap)
+		xcb_free_pixmap(c->conn, c->frame.pixmap);
+
+	if (c->xrender.dst) {
+		xcb_render_free_picture(c->conn, c->xrender.dst);
+		c->xrender.dst = XCB_NONE;
+	}
+
+	__canvas_view_free(c);
+
+	c->frame.width = MAX(c->viewport_width, 1);
+	c->frame.height = MAX(c->viewport_height, 1);
+	c->frame.pixmap = xcb_generate_id(c->conn);
+
+	xcb_create_pixmap(c->conn, c->scr->root_depth, c->frame.pixmap,
+			c->win, c->frame.width, c->frame.height);
+
+	/* the window keeps its own reference to the pixmap */
+	if (c->frame.mode == FRAME_BACKGROUND)
+		xcb_change_window_attributes(c->conn, c->win, XCB_CW_BACK_PIXMAP,
+				&c->frame.pixmap);
+
+	__canvas_damage_all(c);
+}
+
+static void
+__canvas_keep_visible(Canvas_t *c)
+{
+	c->pos.x = CLAMP(c->pos.x, -__canvas_scaled(c, c->width), c->viewport_width);
+	c->pos.y = CLAMP(c->pos.y, -__canvas_scaled(c, c->height), c->viewport_height);
+}
+
+static void
+__history_free_step(struct HistoryStep *st)
+{
+	free(st->tiles);
+	free(st->px);
+	free(st->jpg);
+}
+
+static int
+__history_has_crop(const Canvas_t *c)
+{
+	int i;
+
+	for (i = 0; i < c->history.pos; ++i)
+		if (c->history.steps[i].type == STEP_CROP)
+			return 1;
+
+	return 0;
+}
+
+static void
+__canvas_maybe_compact(Canvas_t *c)
+{
+	struct HistoryStep *st;
+	int i, j;
+
+	/* the buffer is only given back once most of it is out */
+	/* of the view and no crop left to undo needs it */
+	if (c->ops.enabled || __history_has_crop(c) ||
+			(size_t)c->width*c->height*4 >= (size_t)c->stride*c->buf.height)
+		return;
+
+	/* the steps left all happened inside the current view */
+	for (i = 0; i < c->history.pos; ++i) {
+		st = &c->history.steps[i];
+		for (j = 0; j < st->ntiles; ++j) {
+			st->tiles[j].x -= c->buf.x;
+			st->tiles[j].y -= c->buf.y;
+		}
+	}
+
+	__canvas_compact(c);
+}
+
+static void
+__history_trim(Canvas_t *c)
+{
+	int n;
+
+	for (n = 0; n < c->history.count &&
+			c->history.bytes > c->history.budget; ++n) {
+		c->history.bytes -= c->history.steps[n].bytes;
+		__history_free_step(&c->history.steps[n]);
+	}
+
+	if (n == 0)
+		return;
+
+	c->history.count -= n;
+	c->history.pos -= n;
+
+	memmove(c->history.steps, &c->history.steps[n],
+			sizeof(struct HistoryStep) * c->history.count);
+
+	__canvas_maybe_compact(c);
+}
+
+static struct HistoryStep *
+__history_push(Canvas_t *c, int type)
+{
+	struct HistoryStep *st;
+
+	/* a new edit makes everything undone unreachable */
+	while (c->history.count > c->history.pos) {
+		st = &c->history.steps[--c->history.count];
+		c->history.bytes -= st->bytes;
+		__history_free_step(st);
+	}
+
+	c->history.steps = xrealloc(c->history.steps,
+			sizeof(struct HistoryStep) * ++c->history.count);
+
+	st = &c->history.steps[c->history.pos++];
+	memset(st, 0, sizeof(*st));
+	st->type = type;
+
+	return st;
+}
+
+static void
+__history_push_area(Canvas_t *c, int x, int y, int w, int h)
+{
+	struct HistoryStep *st;
+	struct HistoryTile *t;
+	int tx0, ty0, tx1, ty1, tx, ty, vx1, vy1, row;
+	size_t off;
+
+	st = __history_push(c, STEP_PIXELS);
+	__paging_touch(c, y, h);
+
+	/* pixels edits lose the jpeg, the step keeps it around */
+	st->jpg = c->jpg.data;
+	st->jpg_len = c->jpg.len;
+	st->bytes = c->jpg.len;
+	c->jpg.data = NULL;
+
+	x = MAX(x, 0) + c->buf.x;
+	y = MAX(y, 0) + c->buf.y;
+	vx1 = c->buf.x + c->width;
+	vy1 = c->buf.y + c->height;
+	w = MIN(x + w, vx1) - x;
+	h = MIN(y + h, vy1) - y;
+
+	if (w > 0 && h > 0) {
+		/* whole tiles of the buffer grid, cut to the view */
+		tx0 = x / TILE_SIZE; tx1 = (x + w - 1) / TILE_SIZE;
+		ty0 = y / TILE_SIZE; ty1 = (y + h - 1) / TILE_SIZE;
+
+		st->tiles = xmalloc(sizeof(struct HistoryTile) * (tx1-tx0+1) * (ty1-ty0+1));
+
+		for (ty = ty0; ty <= ty1; ++ty) {
+			for (tx = tx0; tx <= tx1; ++tx) {
+				t = &st->tiles[st->ntiles++];
+				t->x = MAX(tx * TILE_SIZE, c->buf.x);
+				t->y = MAX(ty * TILE_SIZE, c->buf.y);
+				t->width = MIN((tx + 1) * TILE_SIZE, vx1) - t->x;
+				t->height = MIN((ty + 1) * TILE_SIZE, vy1) - t->y;
+				st->bytes += (size_t)t->width*t->height*4;
+			}
+		}
+
+		/* a step over the budget would be forgotten right */
+		/* away, so the area isn't copied and undo stops here */
+		if (st->bytes > c->history.budget) {
+			c->history.bytes += st->bytes;
+			__history_trim(c);
+			return;
+		}
+
+		st->px = xmalloc(st->bytes - st->jpg_len);
+
+		for (off = 0, t = st->tiles; t < &st->tiles[st->ntiles]; ++t) {
+			t->px = &st->px[off];
+			for (row = 0; row < t->height; ++row)
+				memcpy(&t->px[row*t->width],
+						&c->buf.px[(size_t)(t->y+row)*c->stride+t->x],
+						4*t->width);
+			off += (size_t)t->width*t->height;
+		}
+	}
+
+	c->history.bytes += st->bytes;
+	__history_trim(c);
+}
+
+static void
+__history_swap_jpg(Canvas_t *c, struct HistoryStep *st)
+{
+	unsigned char *jpg;
+	size_t jpg_len;
+
+	jpg = c->jpg.data; jpg_len = c->jpg.len;
+	c->jpg.data = st->jpg; c->jpg.len = st->jpg_len;
+	st->jpg = jpg; st->jpg_len = jpg_len;
+}
+
+static void
+__ops_invalidate(Canvas_t *c, int i)
+{
+	struct HistoryStep *st;
+	struct Area d, win;
+	int tx, ty;
+
+	st = &c->history.steps[i];
+	d = (struct Area) { st->x, st->y, st->x + st->width, st->y + st->height };
+
+	/* later blurs carry the change further inside their areas */
+	for (++i; i < c->history.pos; ++i) {
+		st = &c->history.steps[i];
+		if (st->type == STEP_OP && st->op == OP_BLUR) {
+			win = __op_window(st, d);
+			d = __area_union(d, win);
+		}
+	}
+
+	for (ty = d.y0 / TILE_SIZE; ty * TILE_SIZE < d.y1; ++ty)
+		for (tx = d.x0 / TILE_SIZE; tx * TILE_SIZE < d.x1; ++tx)
+			c->ops.valid[ty*c->ops.cols+tx] = 0;
+
+	__mip_invalidate(c, d.x0 - c->buf.x, d.y0 - c->buf.y, d.x1 - d.x0, d.y1 - d.y0);
+	__canvas_damage_area(c, d.x0 - c->buf.x, d.y0 - c->buf.y, d.x1 - d.x0, d.y1 - d.y0);
+}
+
+static void
+__history_push_op(Canvas_t *c, int op, int x, int y, int w, int h, int strength)
+{
+	struct HistoryStep *st;
+
+	/* nothing is computed here, the tiles under it just */
+	/* go stale and get evaluated once they are looked at */
+	st = __history_push(c, STEP_OP);
+	st->op = op;
+	st->x = x + c->buf.x;
+	st->y = y + c->buf.y;
+	st->width = w;
+	st->height = h;
+	st->strength = strength;
+	st->jpg = c->jpg.data;
+	st->jpg_len = c->jpg.len;
+	c->jpg.data = NULL;
+
+	__ops_invalidate(c, c->history.pos - 1);
+}
+
+static void
+__history_swap_pixels(Canvas_t *c, struct HistoryStep *st)
+{
+	struct HistoryTile *t;
+	uint32_t tmp[TILE_SIZE], *a, *b;
+	int row;
+
+	/* swapping makes the step its own inverse */
+	for (t = st->tiles; t < &st->tiles[st->ntiles]; ++t) {
+		__paging_touch(c, t->y - c->buf.y, t->height);
+		for (row = 0; row < t->height; ++row) {
+			a = &t->px[row*t->width];
+			b = &c->buf.px[(size_t)(t->y+row)*c->stride+t->x];
+			memcpy(tmp, a, 4*t->width);
+			memcpy(a, b, 4*t->width);
+			memcpy(b, tmp, 4*t->width);
+		}
+
+		__mip_invalidate(c, t->x - c->buf.x, t->y - c->buf.y, t->width, t->height);
+		__canvas_damage_area(c, t->x - c->buf.x, t->y - c->buf.y, t->width, t->height);
+	}
+
+	__history_swap_jpg(c, st);
+}
+
+static void
+__history_swap_view(Canvas_t *c, struct HistoryStep *st)
+{
+	int x, y, w, h;
+
+	x = st->x; y = st->y;
+	w = st->width; h = st->height;
+
+	st->x = c->buf.x; st->y = c->buf.y;
+	st->width = c->width; st->height = c->height;
+
+	c->pos.x += (x - c->buf.x) * c->zoom;
+	c->pos.y += (y - c->buf.y) * c->zoom;
+	c->jpg.x += x - c->buf.x;
+	c->jpg.y += y - c->buf.y;
+
+	c->px = &c->buf.px[(size_t)y*c->stride+x];
+	c->buf.x = x; c->buf.y = y;
+	c->width = w; c->height = h;
+
+	__mip_free(c);
+	__canvas_keep_visible(c);
+	__canvas_damage_all(c);
+}
+
+static Canvas_t *
+__canvas_new(xcb_connection_t *conn, xcb_window_t win, int w, int h)
+{
+	xcb_screen_t *scr;
+	Canvas_t *c;
+
+	scr = xcb_setup_roots_iterator(xcb_get_setup(conn)).data;
+
+	if (NULL == scr)
+		die("can't get default screen");
+
+	c = xcalloc(1, sizeof(Canvas_t));
+
+	c->conn = conn;
+	c->win = win;
+	c->scr = scr;
+	c->viewport_width = w;
+	c->viewport_height = h;
+	c->zoom = 1.0f;
+	c->history.budget = CANVAS_HISTORY_BUDGET;
+
+	c->gc = xcb_generate_id(conn);
+	c->shm = __x_check_mit_shm_extension(conn, &c->shm_fd) ? 1 : 0;
+
+	/* the shm pixmap couldn't be addressed past that, */
+	/* such images are put from client memory */
+	if (w > X_COORD_MAX || h > X_COORD_MAX)
+		c->shm = 0;
+
+	/* nor can shared memory be paged out to a file */
+	if ((size_t)w*h*4 > __ram_budget())
+		c->shm = 0;
+
+	xcb_create_gc(conn, c->gc, win, 0, NULL);
+
+	c->frame.gc = xcb_generate_id(conn);
+	c->frame.outline_gc = xcb_generate_id(conn);
+
+	xcb_create_gc(conn, c->frame.gc, win, 0, NULL);
+	xcb_create_gc(conn, c->frame.outline_gc, win,
+			XCB_GC_FOREGROUND | XCB_GC_LINE_STYLE,
+			(const uint32_t []) { 0xffffff, XCB_LINE_STYLE_DOUBLE_DASH });
+
+	if (__x_check_present_extension(conn, &c->frame.present_opcode)) {
+		c->frame.mode = FRAME_PRESENT;
+		c->frame.region = xcb_generate_id(conn);
+		xcb_xfixes_create_region(conn, c->frame.region, 0, NULL);
+		xcb_present_select_input(conn, xcb_generate_id(conn), win,
+				XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+	}
+
+	if (!c->shm) {
+		/* tiles are sized so one PutImage fits in a request */
+		c->x.put.tile = xmalloc(TILE_SIZE*TILE_SIZE*4);
+		c->x.put.tile_rows = (xcb_get_maximum_request_length(conn) * 4 -
+				sizeof(xcb_put_image_request_t)) / (TILE_SIZE*4);
+		c->x.put.tile_rows = CLAMP(c->x.put.tile_rows, 1, TILE_SIZE);
+	}
+
+	__canvas_set_size(c, w, h);
+	__canvas_frame_resize(c);
+
+	return c;
+}
+
+extern Canvas_t *
+canvas_load(xcb_connection_t *conn, xcb_window_t win, const char *path)
+{
+	return canvas_load_region(conn, win, path, 0, 0, INT_MAX, INT_MAX);
+}
+
+struct CanvasLoad {
+	xcb_connection_t *conn;
+	xcb_window_t win;
+	Canvas_t *c;
+};
+
+static uint32_t *
+__canvas_load_alloc(void *ctx, int w, int h)
+{
+	struct CanvasLoad *l;
+
+	/* images are decoded straight into the canvas buffer */
+	l = ctx;
+	l->c = __canvas_new(l->conn, l->win, w, h);
+
+	return l->c->px;
+}
+
+static Canvas_t *
+__canvas_read(xcb_connection_t *conn, xcb_window_t win, FILE *fp,
+		int x, int y, int w, int h)
+{
+	struct CanvasLoad l;
+	Image_t img;
+
+	l.conn = conn;
+	l.win = win;
+	l.c = NULL;
+
+	if (image_read(fp, x, y, w, h, __canvas_load_alloc, &l, &img) < 0) {
+		if (NULL != l.c)
+			canvas_free(l.c);
+		return NULL;
+	}
+
+	l.c->jpg.data = img.jpg.data;
+	l.c->jpg.len = img.jpg.len;
+	l.c->jpg.x = img.jpg.x;
+	l.c->jpg.y = img.jpg.y;
+
+	__paging_scanned(l.c);
+
+	return l.c;
+}
+
+extern Canvas_t *
+canvas_capture(xcb_connection_t *conn, xcb_window_t win, xcb_drawable_t src,
+		int x, int y, int w, int h)
+{
+	xcb_get_geometry_reply_t *geom;
+	xcb_shm_get_image_reply_t *shm_reply;
+	xcb_get_image_reply_t *reply;
+	const uint32_t *data;
+	uint32_t alpha;
+	int depth, i, j, k, th;
+	Canvas_t *c;
+
+	geom = xcb_get_geometry_reply(conn, xcb_get_geometry(conn, src), NULL);
+
+	if (NULL == geom)
+		return NULL;
+
+	depth = geom->depth;
+
+	/* both come as 32 bits per pixel, which the canvas already is */
+	if ((depth != 24 && depth != 32) ||
+			image_clip(geom->width, geom->height, &x, &y, &w, &h) < 0) {
+		free(geom);
+		return NULL;
+	}
+
+	free(geom);
+	c = __canvas_new(conn, win, w, h);
+
+	if (c->shm) {
+		/* the server writes straight into the canvas segment */
+		shm_reply = xcb_shm_get_image_reply(conn, xcb_shm_get_image(conn, src,
+					x, y, w, h, ~0, XCB_IMAGE_FORMAT_Z_PIXMAP,
+					c->x.shm.seg->seg, 0), NULL);
+
+		if (NULL == shm_reply) {
+			canvas_free(c);
+			return NULL;
+		}
+
+		free(shm_reply);
+		c->opaque = depth == 24;
+
+		return c;
+	}
+
+	/* in strips, so a paged out canvas isn't doubled in memory */
+	alpha = depth == 24 ? 0xff000000 : 0;
+
+	for (j = 0; j < h; j += th) {
+		th = MIN(TILE_SIZE, h - j);
+		reply = xcb_get_image_reply(conn, xcb_get_image(conn,
+					XCB_IMAGE_FORMAT_Z_PIXMAP, src, x, y + j, w, th, ~0), NULL);
+
+		if (NULL == reply) {
+			canvas_free(c);
+			return NULL;
+		}
+
+		data = (const uint32_t *)xcb_get_image_data(reply);
+
+		for (k = 0; k < th; ++k)
+			for (i = 0; i < w; ++i)
+				c->px[(size_t)(j+k)*c->stride+i] = data[k*w+i] | alpha;
+
+		free(reply);
+	}
+
+	__paging_scanned(c);
+
+	return c;
+}
+
+extern Canvas_t *
+canvas_load_region(xcb_connection_t *conn, xcb_window_t win, const char *path,
+		int x, int y, int w, int h)
+{
+	FILE *fp;
+	Canvas_t *c;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if (NULL == (fp = fopen(path, "rb")))
+		return NULL;
+
+	c = __canvas_read(conn, win, fp, x, y, w, h);
+
+	if (fp != stdin)
+		fclose(fp);
+
+	return c;
+}
+
+extern Canvas_t *
+canvas_load_memory(xcb_connection_t *conn, xcb_window_t win,
+		const unsigned char *data, size_t len, int x, int y, int w, int h)
+{
+	FILE *fp;
+	Canvas_t *c;
+
+	if (NULL == (fp = fmemopen((void *)data, len, "rb")))
+		return NULL;
+
+	c = __canvas_read(conn, win, fp, x, y, w, h);
+	fclose(fp);
+
+	return c;
+}
+
+static void
+__canvas_make_opaque(Canvas_t *c)
+{
+	uint32_t *row;
+	int x, y;
+
+	for (y = 0; y < c->height; ++y)
+		for (x = 0, row = &c->px[(size_t)y*c->stride]; x < c->width; ++x)
+			row[x] |= 0xff000000;
+}
+
+static void
+__canvas_image(Canvas_t *c, Image_t *img)
+{
+	img->width = c->width;
+	img->height = c->height;
+	img->stride = c->stride;
+	img->px = c->px;
+	img->buf = NULL;
+	img->jpg.data = c->jpg.data;
+	img->jpg.len = c->jpg.len;
+	img->jpg.x = c->jpg.x;
+	img->jpg.y = c->jpg.y;
+}
+
+extern int
+canvas_save(Canvas_t *c, const char *path)
+{
+	Image_t img;
+	FILE *fp;
+	int rc;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else if (NULL == (fp = fopen(path, "wb")))
+		return -1;
+
+	if (c->ops.enabled)
+		__ops_flush(c);
+
+	if (c->opaque)
+		__canvas_make_opaque(c);
+
+	__canvas_image(c, &img);
+	rc = image_write(&img, path, fp);
+	__paging_scanned(c);
+
+	/* buffered bytes can still fail to go out */
+	if (fp == stdout ? fflush(fp) != 0 : fclose(fp) != 0)
+		rc = -1;
+
+	return rc;
+}
+
+extern Image_t *
+canvas_copy(Canvas_t *c)
+{
+	Image_t img;
+
+	if (c->ops.enabled)
+		__ops_flush(c);
+
+	if (c->opaque)
+		__canvas_make_opaque(c);
+
+	__canvas_image(c, &img);
+
+	return image_copy(&img);
+}
+
+extern void
+canvas_crop(Canvas_t *c, int x, int y, int w, int h)
+{
+	struct HistoryStep *st;
+
+	if (x < 0) w += x, x = 0;
+	if (y < 0) h += y, y = 0;
+	if (x + w >= c->width) w = c->width - x;
+	if (y + h >= c->height) h = c->height - y;
+
+	if (w < 1 || h < 1 || (w == c->width && h == c->height))
+		return;
+
+	st = __history_push(c, STEP_CROP);
+	st->x = c->buf.x;
+	st->y = c->buf.y;
+	st->width = c->width;
+	st->height = c->height;
+
+	/* undoing it needs the buffer that's about to leave the view, */
+	/* which edit list mode keeps anyway */
+	if (!c->ops.enabled)
+		st->bytes = ((size_t)c->width*c->height - (size_t)w*h) * 4;
+	c->history.bytes += st->bytes;
+
+	c->px += (size_t)y*c->stride + x;
+	c->buf.x += x;
+	c->buf.y += y;
+	c->width = w;
+	c->height = h;
+
+	/* levels are laid out from the canvas origin */
+	__mip_free(c);
+
+	c->pos.x += x * c->zoom;
+	c->pos.y += y * c->zoom;
+
+	__canvas_keep_visible(c);
+	__canvas_damage_all(c);
+
+	c->jpg.x += x;
+	c->jpg.y += y;
+
+	__history_trim(c);
+	__canvas_maybe_compact(c);
+}
+
+extern void
+canvas_grayscale(Canvas_t *c, int x, int y, int w, int h)
+{
+	if (x < 0) w += x, x = 0;
+	if (y < 0) h += y, y = 0;
+	if (x + w >= c->width) w = c->width - x;
+	if (y + h >= c->height) h = c->height - y;
+
+	if (w < 1 || h < 1)
+		return;
+
+	if (c->ops.enabled) {
+		__history_push_op(c, OP_GRAYSCALE, x, y, w, h, 0);
+		return;
+	}
+
+	__history_push_area(c, x, y, w, h);
+	image_grayscale_pixels(&c->px[(size_t)y*c->stride+x], c->stride, w, h);
+
+	__mip_invalidate(c, x, y, w, h);
+	__canvas_damage_area(c, x, y, w, h);
+}
+
+extern void
+canvas_blur(Canvas_t *c, int x, int y, int w, int h, int strength)
+{
+	if (x < 0) w += x, x = 0;
+	if (y < 0) h += y, y = 0;
+	if (x + w >= c->width) w = c->width - x;
+	if (y + h >= c->height) h = c->height - y;
+
+	if (w < 1 || h < 1)
+		return;
+
+	if (c->ops.enabled) {
+		__history_push_op(c, OP_BLUR, x, y, w, h, strength);
+		return;
+	}
+
+	__history_push_area(c, x, y, w, h);
+	if (image_blur_pixels(&c->px[(size_t)y*c->stride+x], c->stride, w, h, strength) < 0)
+		die("OOM");
+
+	__mip_invalidate(c, x, y, w, h);
+	__canvas_damage_area(c, x, y, w, h);
+}
+
+extern void
+canvas_move_relative(Canvas_t *c, int offx, int offy)
+{
+	c->pos.x += offx;
+	c->pos.y += offy;
+
+	__canvas_keep_visible(c);
+	__canvas_damage_all(c);
+}
+
+extern int
+canvas_set_viewport(Canvas_t *c, int vw, int vh)
+{
+	c->pos.x += ((float)vw - c->viewport_width) / 2;
+	c->pos.y += ((float)vh - c->viewport_height) / 2;
+
+	c->viewport_width = vw;
+	c->viewport_height = vh;
+
+	__canvas_keep_visible(c);
+	__canvas_damage_all(c);
+
+	if (vw == c->frame.width && vh == c->frame.height)
+		return 0;
+
+	__canvas_frame_resize(c);
+
+	return 1;
+}
+
+extern float
+canvas_get_zoom(Canvas_t *c)
+{
+	return c->zoom;
+}
+
+extern void
+canvas_set_zoom(Canvas_t *c, float zoom, int x, int y)
+{
+	zoom = CLAMP(zoom, CANVAS_ZOOM_MIN, CANVAS_ZOOM_MAX);
+
+	/* keep the canvas point under (x, y) in place */
+	c->pos.x = x - (x - c->pos.x) * zoom / c->zoom;
+	c->pos.y = y - (y - c->pos.y) * zoom / c->zoom;
+	c->zoom = zoom;
+
+	__canvas_keep_visible(c);
+	__canvas_damage_all(c);
+}
+
+extern int
+canvas_undo(Canvas_t *c)
+{
+	struct HistoryStep *st;
+
+	if (c->history.pos == 0)
+		return 0;
+
+	st = &c->history.steps[c->history.pos - 1];
+
+	if (st->type == STEP_OP) {
+		__ops_invalidate(c, c->history.pos - 1);
+		__history_swap_jpg(c, st);
+	}
+
+	--c->history.pos;
+
+	if (st->type == STEP_CROP)
+		__history_swap_view(c, st);
+	else if (st->type == STEP_PIXELS)
+		__history_swap_pixels(c, st);
+
+	return 1;
+}
+
+extern int
+canvas_redo(Canvas_t *c)
+{
+	struct HistoryStep *st;
+
+	if (c->history.pos == c->history.count)
+		return 0;
+
+	st = &c->history.steps[c->history.pos++];
+
+	if (st->type == STEP_OP) {
+		__ops_invalidate(c, c->history.pos - 1);
+		__history_swap_jpg(c, st);
+	} else if (st->type == STEP_CROP) {
+		__history_swap_view(c, st);
+	} else {
+		__history_swap_pixels(c, st);
+	}
+
+	return 1;
+}
+
+extern int
+canvas_adjust_strength(Canvas_t *c, int delta)
+{
+	struct HistoryStep *st;
+	int strength;
+
+	if (c->history.pos == 0)
+		return 0;
+
+	st = &c->history.steps[c->history.pos - 1];
+	strength = MAX(st->strength + delta, 1);
+
+	if (st->type != STEP_OP || st->op != OP_BLUR || strength == st->strength)
+		return 0;
+
+	/* stale under both the old and the new reach */
+	__ops_invalidate(c, c->history.pos - 1);
+	st->strength = strength;
+	__ops_invalidate(c, c->history.pos - 1);
+
+	return 1;
+}
+
+extern void
+canvas_use_edit_list(Canvas_t *c)
+{
+	c->ops.enabled = 1;
+	c->ops.size = (size_t)c->stride*c->buf.height*4;
+	c->ops.src = __pixels_alloc(c->ops.size, &c->ops.mapped);
+	c->ops.cols = (c->stride + TILE_SIZE - 1) / TILE_SIZE;
+	c->ops.rows = (c->buf.height + TILE_SIZE - 1) / TILE_SIZE;
+	c->ops.valid = xmalloc(c->ops.cols*c->ops.rows);
+
+	memcpy(c->ops.src, c->buf.px, c->ops.size);
+	__paging_scanned(c);
+	memset(c->ops.valid, 1, c->ops.cols*c->ops.rows);
+}
+
+extern void
+canvas_set_history_budget(Canvas_t *c, size_t bytes)
+{
+	c->history.budget = bytes;
+	__history_trim(c);
+}
+
+extern void
+canvas_set_ram_budget(size_t bytes)
+{
+	ram_budget = bytes;
+}
+
+extern int
+canvas_use_xrender_zoom(Canvas_t *c)
+{
+	/* the server needs the image in a pixmap to scale from */
+	if (!c->shm || !__x_check_render_extension(c->conn,
+				c->scr->root_visual, &c->xrender.format))
+		return -1;
+
+	c->xrender.enabled = 1;
+	__mip_free(c);
+	__canvas_view_free(c);
+	__canvas_damage_all(c);
+
+	return 0;
+}
+
+extern void
+canvas_set_background(Canvas_t *c, uint32_t color)
+{
+	xcb_change_gc(c->conn, c->frame.gc, XCB_GC_FOREGROUND, &color);
+	__canvas_damage_all(c);
+}
+
+extern void
+canvas_use_window_background(Canvas_t *c)
+{
+	/* present isn't used from here on, nor its region */
+	if (c->frame.mode == FRAME_PRESENT) {
+		xcb_xfixes_destroy_region(c->conn, c->frame.region);
+		c->frame.region = XCB_NONE;
+		c->frame.pending = 0;
+	}
+
+	c->frame.mode = FRAME_BACKGROUND;
+	__canvas_frame_resize(c);
+}
+
+extern void
+canvas_set_selection(Canvas_t *c, const xcb_rectangle_t *r)
+{
+	if (c->selection.active)
+		__canvas_damage_outline(c, &c->selection.rect);
+
+	c->selection.active = NULL != r;
+
+	if (NULL != r) {
+		c->selection.rect = *r;
+		__canvas_damage_outline(c, r);
+	}
+}
+
+extern void
+canvas_damage(Canvas_t *c, int x, int y, int w, int h)
+{
+	xcb_rectangle_t *r, *best;
+	int i, x1, y1, growth, best_growth;
+
+	x1 = MIN(x + w, c->viewport_width);
+	y1 = MIN(y + h, c->viewport_height);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+
+	if (x >= x1 || y >= y1)
+		return;
+
+	best = NULL;
+	best_growth = 0;
+
+	for (i = 0; i < c->damage.count; ++i) {
+		r = &c->damage.rects[i];
+
+		if (x >= r->x && y >= r->y &&
+				x1 <= r->x + r->width && y1 <= r->y + r->height)
+			return;
+
+		growth = (MAX(x1, r->x + r->width) - MIN(x, r->x)) *
+			(MAX(y1, r->y + r->height) - MIN(y, r->y)) -
+			r->width * r->height;
+
+		if (NULL == best || growth < best_growth) {
+			best = r;
+			best_growth = growth;
+		}
+	}
+
+	if (c->damage.count < DAMAGE_RECTS) {
+		r = &c->damage.rects[c->damage.count++];
+	} else {
+		/* out of slots, grow the rectangle that grows the least */
+		r = best;
+		x1 = MAX(x1, r->x + r->width);
+		y1 = MAX(y1, r->y + r->height);
+		x = MIN(x, r->x);
+		y = MIN(y, r->y);
+	}
+
+	r->x = x;
+	r->y = y;
+	r->width = x1 - x;
+	r->height = y1 - y;
+}
+
+extern void
+canvas_render(Canvas_t *c)
+{
+	xcb_rectangle_t *r;
+	int i;
+
+	/* the last frame isn't on screen yet, the damage */
+	/* waits for its complete notify */
+	if (c->frame.pending || c->damage.count == 0) {
+		xcb_flush(c->conn);
+		return;
+	}
+
+	for (i = 0; i < c->damage.count; ++i)
+		__canvas_render_rect(c, &c->damage.rects[i]);
+
+	if (c->selection.active)
+		xcb_poly_rectangle(c->conn, c->frame.pixmap, c->frame.outline_gc,
+				1, &c->selection.rect);
+
+	switch (c->frame.mode) {
+	case FRAME_PRESENT:
+		/* copy, never flip, so the pixmap is free once it completes */
+		xcb_xfixes_set_region(c->conn, c->frame.region,
+				c->damage.count, c->damage.rects);
+		xcb_present_pixmap(c->conn, c->win, c->frame.pixmap,
+				++c->frame.serial, XCB_NONE, c->frame.region, 0, 0,
+				XCB_NONE, XCB_NONE, XCB_NONE, XCB_PRESENT_OPTION_COPY,
+				0, 0, 0, 0, NULL);
+		c->frame.pending = 1;
+		break;
+	case FRAME_BACKGROUND:
+		/* exposes are handled by the server from here on */
+		for (i = 0; i < c->damage.count; ++i) {
+			r = &c->damage.rects[i];
+			xcb_clear_area(c->conn, 0, c->win, r->x, r->y, r->width, r->height);
+		}
+		break;
+	default:
+		for (i = 0; i < c->damage.count; ++i) {
+			r = &c->damage.rects[i];
+			xcb_copy_area(c->conn, c->frame.pixmap, c->win, c->gc,
+					r->x, r->y, r->x, r->y, r->width, r->height);
+		}
+		break;
+	}
+
+	c->damage.count = 0;
+
+	xcb_flush(c->conn);
+}
+
+extern int
+canvas_handle_event(Canvas_t *c, xcb_generic_event_t *ev)
+{
+	xcb_present_complete_notify_event_t *cn;
+
+	if ((ev->response_type & ~0x80) != XCB_GE_GENERIC)
+		return 0;
+
+	cn = (xcb_present_complete_notify_event_t *)(ev);
+
+	if (c->frame.mode != FRAME_PRESENT ||
+			cn->extension != c->frame.present_opcode ||
+			cn->event_type != XCB_PRESENT_EVENT_COMPLETE_NOTIFY)
+		return 0;
+
+	if (cn->serial == c->frame.serial)
+		c->frame.pending = 0;
+
+	return !c->frame.pending && c->damage.count > 0;
+}
+
+extern void
+canvas_viewport_to_canvas_pos(Canvas_t *c, int x, int y, int *out_x, int *out_y)
+{
+	int ox, oy;
+
+	__canvas_origin(c, &ox, &oy);
+
+	*out_x = floorf((x - ox) / c->zoom);
+	*out_y = floorf((y - oy) / c->zoom);
+}
+
+extern void
+canvas_free(Canvas_t *c)
+{
+	int i;
+
+	xcb_free_gc(c->conn, c->gc);
+	__canvas_free_buffer(c);
+
+	xcb_free_gc(c->conn, c->frame.gc);
+	xcb_free_gc(c->conn, c->frame.outline_gc);
+	xcb_free_pixmap(c->conn, c->frame.pixmap);
+
+	if (c->xrender.dst)
+		xcb_render_free_picture(c->conn, c->xrender.dst);
+
+	if (c->frame.region != XCB_NONE)
+		xcb_xfixes_destroy_region(c->conn, c->frame.region);
+
+	__mip_free(c);
+	__canvas_view_free(c);
+
+	if (!c->shm)
+		free(c->x.put.tile);
+
+	for (i = 0; i < SHM_POOL_SEGMENTS; ++i)
+		if (NULL != c->pool[i].addr)
+			__shm_destroy(c, &c->pool[i]);
+
+	for (i = 0; i < c->history.count; ++i)
+		__history_free_step(&c->history.steps[i]);
+
+	free(c->history.steps);
+	if (NULL != c->ops.src)
+		__pixels_free(c->ops.src, c->ops.size, c->ops.mapped);
+	free(c->ops.valid);
+	free(c->jpg.data);
 	free(c);
 }
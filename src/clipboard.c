@@ -0,0 +1,480 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+/* https://www.x.org/docs/ICCCM/icccm.pdf, section 2 */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <time.h>
+#include <xcb/xcb.h>
+#include <xcb/xproto.h>
+
+#include "clipboard.h"
+#include "canvas.h"
+#include "image.h"
+#include "utils.h"
+#include "log.h"
+
+/* properties larger than this go in pieces, through INCR */
+#define CLIPBOARD_CHUNK_SIZE (256*1024)
+#define CLIPBOARD_TRANSFERS 16
+#define CLIPBOARD_TIMEOUT 5000
+
+enum {
+	ATOM_CLIPBOARD,
+	ATOM_TARGETS,
+	ATOM_INCR,
+	ATOM_PNG,
+	ATOM_BMP,
+	ATOM_PROPERTY,
+	ATOM_COUNT
+};
+
+/* what is served, png first as it's what most */
+/* programs look for; bmp costs no compression */
+enum {
+	FORMAT_PNG,
+	FORMAT_BMP,
+	FORMAT_COUNT
+};
+
+static const char *atom_names[ATOM_COUNT] = {
+	"CLIPBOARD", "TARGETS", "INCR", "image/png", "image/bmp", "XCANDB_CLIPBOARD"
+};
+
+static const int format_atoms[FORMAT_COUNT] = { ATOM_PNG, ATOM_BMP };
+
+struct Transfer {
+	xcb_window_t requestor;
+	xcb_atom_t property;
+	int format;
+	size_t offset;
+	long last;
+};
+
+static struct {
+	xcb_connection_t *conn;
+	xcb_window_t win;
+	xcb_atom_t atoms[ATOM_COUNT];
+	size_t chunk;
+	int owner;
+
+	/* copied when the selection is taken, only encoded */
+	/* to the formats someone actually asks for */
+	Image_t *img;
+
+	struct {
+		unsigned char *data;
+		size_t len;
+	} enc[FORMAT_COUNT];
+
+	int ntransfers;
+	struct Transfer transfers[CLIPBOARD_TRANSFERS];
+} clip;
+
+static void
+__clipboard_encode(int f)
+{
+	FILE *fp;
+
+	if (NULL != clip.enc[f].data)
+		return;
+
+	if (NULL == (fp = open_memstream((char **)&clip.enc[f].data, &clip.enc[f].len)))
+		die("open_memstream:");
+
+	/* the name only picks the format */
+	image_write(clip.img, f == FORMAT_PNG ? "clipboard.png" : "clipboard.bmp", fp);
+
+	fclose(fp);
+}
+
+static void
+__clipboard_drop(void)
+{
+	int f;
+
+	if (NULL != clip.img)
+		image_free(clip.img);
+	clip.img = NULL;
+
+	for (f = 0; f < FORMAT_COUNT; ++f) {
+		free(clip.enc[f].data);
+		clip.enc[f].data = NULL;
+	}
+}
+
+static long
+__clipboard_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void
+__clipboard_end_transfer(struct Transfer *t, int gone)
+{
+	/* stop listening to the requestor, if it's still there */
+	if (!gone)
+		xcb_change_window_attributes(clip.conn, t->requestor,
+				XCB_CW_EVENT_MASK, (const uint32_t []) { 0 });
+
+	*t = clip.transfers[--clip.ntransfers];
+
+	if (!clip.owner && clip.ntransfers == 0)
+		__clipboard_drop();
+}
+
+static void
+__clipboard_expire(void)
+{
+	struct Transfer *t;
+	long now;
+
+	/* requestors that stopped asking for pieces give */
+	/* their slots up, or they'd hold them forever */
+	now = __clipboard_now();
+
+	for (t = clip.transfers; t < &clip.transfers[clip.ntransfers]; )
+		if (now - t->last > CLIPBOARD_TIMEOUT)
+			__clipboard_end_transfer(t, 0);
+		else
+			++t;
+}
+
+extern void
+clipboard_init(xcb_connection_t *conn, xcb_window_t win)
+{
+	xcb_intern_atom_cookie_t cookies[ATOM_COUNT];
+	xcb_intern_atom_reply_t *reply;
+	int i;
+
+	clip.conn = conn;
+	clip.win = win;
+	clip.chunk = MIN(CLIPBOARD_CHUNK_SIZE,
+			xcb_get_maximum_request_length(conn) * 4 - 64);
+
+	for (i = 0; i < ATOM_COUNT; ++i)
+		cookies[i] = xcb_intern_atom(conn, 0, strlen(atom_names[i]), atom_names[i]);
+
+	for (i = 0; i < ATOM_COUNT; ++i) {
+		if (NULL == (reply = xcb_intern_atom_reply(conn, cookies[i], NULL)))
+			die("xcb_intern_atom failed");
+		clip.atoms[i] = reply->atom;
+		free(reply);
+	}
+}
+
+extern int
+clipboard_own(Canvas_t *c, xcb_timestamp_t time)
+{
+	xcb_get_selection_owner_reply_t *reply;
+
+	/* transfers of a previous copy are cut short */
+	while (clip.ntransfers > 0)
+		__clipboard_end_transfer(&clip.transfers[0], 0);
+
+	__clipboard_drop();
+	if (NULL == (clip.img = canvas_copy(c)))
+		return -1;
+
+	xcb_set_selection_owner(clip.conn, clip.win, clip.atoms[ATOM_CLIPBOARD], time);
+	reply = xcb_get_selection_owner_reply(clip.conn, xcb_get_selection_owner(
+				clip.conn, clip.atoms[ATOM_CLIPBOARD]), NULL);
+
+	clip.owner = NULL != reply && reply->owner == clip.win;
+	free(reply);
+
+	if (!clip.owner)
+		__clipboard_drop();
+
+	return clip.owner ? 0 : -1;
+}
+
+extern void
+clipboard_handle_request(xcb_selection_request_event_t *ev)
+{
+	xcb_selection_notify_event_t notify;
+	xcb_atom_t targets[FORMAT_COUNT + 1];
+	struct Transfer *t;
+	uint32_t len;
+	int f;
+
+	memset(&notify, 0, sizeof(notify));
+	notify.response_type = XCB_SELECTION_NOTIFY;
+	notify.time = ev->time;
+	notify.requestor = ev->requestor;
+	notify.selection = ev->selection;
+	notify.target = ev->target;
+
+	/* obsolete clients leave the property to the owner */
+	notify.property = ev->property == XCB_NONE ? ev->target : ev->property;
+
+	for (f = 0; f < FORMAT_COUNT; ++f)
+		if (ev->target == clip.atoms[format_atoms[f]])
+			break;
+
+	if (!clip.owner || ev->selection != clip.atoms[ATOM_CLIPBOARD]) {
+		notify.property = XCB_NONE;
+	} else if (ev->target == clip.atoms[ATOM_TARGETS]) {
+		targets[0] = clip.atoms[ATOM_TARGETS];
+		for (f = 0; f < FORMAT_COUNT; ++f)
+			targets[f+1] = clip.atoms[format_atoms[f]];
+		xcb_change_property(clip.conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+				notify.property, XCB_ATOM_ATOM, 32, FORMAT_COUNT + 1, targets);
+	} else if (f == FORMAT_COUNT) {
+		notify.property = XCB_NONE;
+	} else {
+		__clipboard_encode(f);
+
+		__clipboard_expire();
+
+		if (clip.enc[f].len <= clip.chunk) {
+			xcb_change_property(clip.conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+					notify.property, ev->target, 8, clip.enc[f].len, clip.enc[f].data);
+		} else if (clip.ntransfers == CLIPBOARD_TRANSFERS) {
+			notify.property = XCB_NONE;
+		} else {
+			/* the requestor deleting the property asks for the next */
+			/* piece, which is sent from the event loop as it happens */
+			t = &clip.transfers[clip.ntransfers++];
+			t->requestor = ev->requestor;
+			t->property = notify.property;
+			t->format = f;
+			t->offset = 0;
+			t->last = __clipboard_now();
+
+			len = MIN(clip.enc[f].len, UINT32_MAX);
+
+			/* structure changes tell when the requestor goes away */
+			xcb_change_window_attributes(clip.conn, ev->requestor, XCB_CW_EVENT_MASK,
+					(const uint32_t []) { XCB_EVENT_MASK_STRUCTURE_NOTIFY |
+					XCB_EVENT_MASK_PROPERTY_CHANGE });
+			xcb_change_property(clip.conn, XCB_PROP_MODE_REPLACE, ev->requestor,
+					notify.property, clip.atoms[ATOM_INCR], 32, 1, &len);
+		}
+	}
+
+	xcb_send_event(clip.conn, 0, ev->requestor, XCB_EVENT_MASK_NO_EVENT,
+			(const char *)&notify);
+	xcb_flush(clip.conn);
+}
+
+extern void
+clipboard_handle_clear(xcb_selection_clear_event_t *ev)
+{
+	if (ev->selection != clip.atoms[ATOM_CLIPBOARD])
+		return;
+
+	/* transfers already started are still finished */
+	clip.owner = 0;
+	__clipboard_expire();
+
+	if (clip.ntransfers == 0)
+		__clipboard_drop();
+}
+
+extern void
+clipboard_handle_property(xcb_property_notify_event_t *ev)
+{
+	struct Transfer *t;
+	size_t n;
+	int f;
+
+	if (ev->state != XCB_PROPERTY_DELETE)
+		return;
+
+	for (t = clip.transfers; t < &clip.transfers[clip.ntransfers]; ++t)
+		if (t->requestor == ev->window && t->property == ev->atom)
+			break;
+
+	if (t == &clip.transfers[clip.ntransfers])
+		return;
+
+	f = t->format;
+	n = MIN(clip.chunk, clip.enc[f].len - t->offset);
+
+	/* a piece of length zero ends the transfer */
+	xcb_change_property(clip.conn, XCB_PROP_MODE_REPLACE, t->requestor, t->property,
+			clip.atoms[format_atoms[f]], 8, n, &clip.enc[f].data[t->offset]);
+
+	t->offset += n;
+	t->last = __clipboard_now();
+
+	if (n == 0)
+		__clipboard_end_transfer(t, 0);
+
+	xcb_flush(clip.conn);
+}
+
+extern void
+clipboard_handle_destroy(xcb_destroy_notify_event_t *ev)
+{
+	struct Transfer *t;
+
+	for (t = clip.transfers; t < &clip.transfers[clip.ntransfers]; )
+		if (t->requestor == ev->window)
+			__clipboard_end_transfer(t, 1);
+		else
+			++t;
+}
+
+static xcb_generic_event_t *
+__clipboard_wait(uint8_t type, xcb_atom_t atom)
+{
+	xcb_generic_event_t *ev;
+	xcb_property_notify_event_t *pev;
+	struct pollfd pfd;
+
+	pfd.fd = xcb_get_file_descriptor(clip.conn);
+	pfd.events = POLLIN;
+
+	for (;;) {
+		while (NULL != (ev = xcb_poll_for_event(clip.conn))) {
+			if ((ev->response_type & ~0x80) == type) {
+				pev = (xcb_property_notify_event_t *)ev;
+				if (type != XCB_PROPERTY_NOTIFY || (pev->atom == atom &&
+						pev->state == XCB_PROPERTY_NEW_VALUE))
+					return ev;
+			}
+			free(ev);
+		}
+
+		/* an owner that stopped answering isn't waited on forever */
+		if (xcb_connection_has_error(clip.conn) ||
+				poll(&pfd, 1, CLIPBOARD_TIMEOUT) < 1)
+			return NULL;
+	}
+}
+
+static xcb_get_property_reply_t *
+__clipboard_take(void)
+{
+	/* deleting it is what tells an incr owner to go on */
+	return xcb_get_property_reply(clip.conn, xcb_get_property(clip.conn, 1,
+				clip.win, clip.atoms[ATOM_PROPERTY], XCB_GET_PROPERTY_TYPE_ANY,
+				0, UINT32_MAX / 4), NULL);
+}
+
+static unsigned char *
+__clipboard_convert(xcb_atom_t target, size_t *len)
+{
+	xcb_selection_notify_event_t *notify;
+	xcb_get_property_reply_t *reply;
+	xcb_generic_event_t *ev;
+	unsigned char *data;
+	size_t n;
+	int refused;
+
+	xcb_convert_selection(clip.conn, clip.win, clip.atoms[ATOM_CLIPBOARD],
+			target, clip.atoms[ATOM_PROPERTY], XCB_CURRENT_TIME);
+	xcb_flush(clip.conn);
+
+	if (NULL == (ev = __clipboard_wait(XCB_SELECTION_NOTIFY, XCB_NONE)))
+		return NULL;
+
+	notify = (xcb_selection_notify_event_t *)ev;
+	refused = notify->property == XCB_NONE;
+	free(ev);
+
+	if (refused || NULL == (reply = __clipboard_take()))
+		return NULL;
+
+	data = NULL;
+	*len = 0;
+
+	if (reply->type != clip.atoms[ATOM_INCR]) {
+		*len = xcb_get_property_value_length(reply);
+		data = xmalloc(*len + 1);
+		memcpy(data, xcb_get_property_value(reply), *len);
+		free(reply);
+		return data;
+	}
+
+	free(reply);
+
+	/* then the pieces, until an empty one */
+	while (NULL != (ev = __clipboard_wait(XCB_PROPERTY_NOTIFY, clip.atoms[ATOM_PROPERTY]))) {
+		free(ev);
+
+		if (NULL == (reply = __clipboard_take()))
+			break;
+
+		n = xcb_get_property_value_length(reply);
+
+		if (n == 0) {
+			free(reply);
+			return data;
+		}
+
+		data = xrealloc(data, *len + n);
+		memcpy(&data[*len], xcb_get_property_value(reply), n);
+		*len += n;
+		free(reply);
+	}
+
+	free(data);
+
+	return NULL;
+}
+
+extern unsigned char *
+clipboard_read(size_t *len)
+{
+	xcb_get_window_attributes_reply_t *attr;
+	unsigned char *data;
+	uint32_t mask;
+	int f;
+
+	attr = xcb_get_window_attributes_reply(clip.conn,
+			xcb_get_window_attributes(clip.conn, clip.win), NULL);
+
+	if (NULL == attr)
+		return NULL;
+
+	/* incremental transfers are driven by property changes */
+	mask = attr->your_event_mask;
+	free(attr);
+
+	xcb_change_window_attributes(clip.conn, clip.win, XCB_CW_EVENT_MASK,
+			(const uint32_t []) { mask | XCB_EVENT_MASK_PROPERTY_CHANGE });
+
+	for (f = 0, data = NULL; f < FORMAT_COUNT && NULL == data; ++f)
+		data = __clipboard_convert(clip.atoms[format_atoms[f]], len);
+
+	xcb_change_window_attributes(clip.conn, clip.win, XCB_CW_EVENT_MASK, &mask);
+
+	return data;
+}
+
+extern void
+clipboard_free(void)
+{
+	while (clip.ntransfers > 0)
+		__clipboard_end_transfer(&clip.transfers[0], 0);
+
+	__clipboard_drop();
+}
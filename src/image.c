@@ -0,0 +1,697 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+
+/* stb is built in here, static, so nothing of it leaks out */
+/* of libxcandb into a program that brings its own; what of */
+/* it goes unused is only checked at the end of the file */
+#pragma GCC diagnostic ignored "-Wunused-function"
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+
+#include "image.h"
+#include "jpg.h"
+#include "png.h"
+#include "qoi.h"
+#include "utils.h"
+
+#define ALPHA(c) ((c>>24) & 0xff)
+#define RED(c) ((c>>16) & 0xff)
+#define GREEN(c) ((c>>8) & 0xff)
+#define BLUE(c) ((c>>0) & 0xff)
+
+/* tall blurs go a band of about this many pixels at a */
+/* time, so they never need a copy of the whole area */
+#define IMAGE_BLUR_BAND_PIXELS (1024*1024)
+
+static inline uint32_t
+__pack_color(unsigned char *p)
+{
+	return (uint32_t)(p[3]<<24)|(p[0]<<16)|(p[1]<<8)|p[2];
+}
+
+static inline void
+__unpack_color(uint32_t c, unsigned char *p)
+{
+	p[0] = RED(c);
+	p[1] = GREEN(c);
+	p[2] = BLUE(c);
+	p[3] = ALPHA(c);
+}
+
+static unsigned char *
+__read_all(FILE *fp, const unsigned char *head, size_t headlen, size_t *len)
+{
+	unsigned char *data, *grown;
+	size_t size, cap;
+
+	cap = 64 * 1024;
+
+	if (NULL == (data = malloc(cap)))
+		return NULL;
+
+	memcpy(data, head, headlen);
+	size = headlen;
+
+	while (!feof(fp) && !ferror(fp)) {
+		if (size == cap) {
+			if (cap > SIZE_MAX / 2 || NULL == (grown = realloc(data, cap *= 2))) {
+				free(data);
+				return NULL;
+			}
+			data = grown;
+		}
+		size += fread(&data[size], 1, cap - size, fp);
+	}
+
+	if (ferror(fp)) {
+		free(data);
+		return NULL;
+	}
+
+	*len = size;
+
+	return data;
+}
+
+static int
+__path_has_ext(const char *path, const char *ext)
+{
+	size_t len, extlen;
+
+	/* only the end counts, "./.ff/x.png" is a png */
+	len = strlen(path);
+	extlen = strlen(ext);
+
+	return len >= extlen && strcmp(&path[len - extlen], ext) == 0;
+}
+
+static int
+__path_is_jpg(const char *path)
+{
+	return __path_has_ext(path, ".jpg") || __path_has_ext(path, ".jpeg");
+}
+
+static uint32_t *
+__image_malloc(void *ctx, int w, int h)
+{
+	(void) ctx;
+	return malloc((size_t)w*h*4);
+}
+
+static int
+__image_alloc(Image_t *img, ImageAllocator alloc, void *ctx, int w, int h)
+{
+	img->width = img->stride = w;
+	img->height = h;
+	img->px = alloc(ctx, w, h);
+
+	return NULL == img->px ? -1 : 0;
+}
+
+static int
+__image_read_farbfeld(Image_t *img, FILE *fp, int iw, int rx, int ry)
+{
+	unsigned char *row, *p;
+	int x, y;
+
+	if (NULL == (row = malloc((size_t)iw*8)))
+		return -1;
+
+	/* rows above the region are seeked past, or read */
+	/* and dropped when coming from a pipe */
+	if (fp == stdin || fseek(fp, (long)ry*iw*8, SEEK_CUR) < 0)
+		for (y = 0; y < ry; ++y)
+			if (fread(row, 8, iw, fp) != (size_t)iw)
+				break;
+
+	for (y = 0; y < img->height; ++y) {
+		if (fread(row, 8, iw, fp) != (size_t)iw) {
+			free(row);
+			return -1;
+		}
+
+		/* keep the most significant byte of each 16-bit channel */
+		for (x = 0, p = &row[(size_t)rx*8]; x < img->width; ++x, p += 8)
+			img->px[(size_t)y*img->stride+x] = (uint32_t)p[6]<<24 | p[0]<<16 | p[2]<<8 | p[4];
+	}
+
+	free(row);
+
+	return 0;
+}
+
+static int
+__image_write_farbfeld(const Image_t *img, FILE *fp)
+{
+	unsigned char hdr[16] = "farbfeld", *row, *p;
+	uint32_t col;
+	int x, y;
+
+	hdr[8] = img->width >> 24; hdr[9] = img->width >> 16;
+	hdr[10] = img->width >> 8; hdr[11] = img->width;
+	hdr[12] = img->height >> 24; hdr[13] = img->height >> 16;
+	hdr[14] = img->height >> 8; hdr[15] = img->height;
+
+	if (NULL == (row = malloc((size_t)img->width*8)))
+		return -1;
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+
+	for (y = 0; y < img->height; ++y) {
+		for (x = 0, p = row; x < img->width; ++x, p += 8) {
+			col = img->px[(size_t)y*img->stride+x];
+			p[0] = p[1] = RED(col);
+			p[2] = p[3] = GREEN(col);
+			p[4] = p[5] = BLUE(col);
+			p[6] = p[7] = ALPHA(col);
+		}
+		fwrite(row, 8, img->width, fp);
+	}
+
+	free(row);
+
+	return 0;
+}
+
+static inline void
+__write16(unsigned char *p, unsigned v)
+{
+	p[0] = v; p[1] = v >> 8;
+}
+
+static inline void
+__write32(unsigned char *p, uint32_t v)
+{
+	p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+}
+
+static int
+__image_write_bmp(const Image_t *img, FILE *fp)
+{
+	unsigned char hdr[14+108] = { 'B', 'M' }, *row;
+	int x, y;
+
+	/* the same v4 header stb writes, with bitfields */
+	/* that make every pixel its 0xAARRGGBB value */
+	__write32(&hdr[2], 14 + 108 + (uint32_t)img->width*img->height*4);
+	__write32(&hdr[10], 14 + 108);
+	__write32(&hdr[14], 108);
+	__write32(&hdr[18], img->width);
+	__write32(&hdr[22], img->height);
+	__write16(&hdr[26], 1);
+	__write16(&hdr[28], 32);
+	__write32(&hdr[30], 3);
+	__write32(&hdr[54], 0x00ff0000);
+	__write32(&hdr[58], 0x0000ff00);
+	__write32(&hdr[62], 0x000000ff);
+	__write32(&hdr[66], 0xff000000);
+
+	if (NULL == (row = malloc((size_t)img->width*4)))
+		return -1;
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+
+	/* bottom up, a row at a time */
+	for (y = img->height - 1; y >= 0; --y) {
+		for (x = 0; x < img->width; ++x)
+			__write32(&row[x*4], img->px[(size_t)y*img->stride+x]);
+		fwrite(row, 4, img->width, fp);
+	}
+
+	free(row);
+
+	return 0;
+}
+
+static int
+__image_write_tga(const Image_t *img, FILE *fp)
+{
+	unsigned char hdr[18] = { 0, 0, 10 }, *row, *out;
+	const uint32_t *in;
+	int x, y, i, len, diff;
+
+	if (img->width > 0xffff || img->height > 0xffff)
+		return -1;
+
+	/* the same run length encoded header stb writes */
+	__write16(&hdr[12], img->width);
+	__write16(&hdr[14], img->height);
+	hdr[16] = 32;
+	hdr[17] = 8;
+
+	/* a pixel takes at most a byte of packet header more */
+	if (NULL == (row = malloc((size_t)img->width*5)))
+		return -1;
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+
+	/* bottom up, a row at a time, packets never span rows: a */
+	/* run repeats one pixel, a raw packet lists up to 128 */
+	for (y = img->height - 1; y >= 0; --y) {
+		in = &img->px[(size_t)y*img->stride];
+		out = row;
+
+		for (x = 0; x < img->width; x += len) {
+			len = 1;
+			diff = 1;
+
+			if (x < img->width - 1) {
+				++len;
+				diff = in[x] != in[x+1];
+				for (i = x + 2; i < img->width && len < 128; ++i) {
+					/* raw packets end where two pixels apart match, */
+					/* as stb does, so the output stays the same */
+					if (diff ? in[i-2] == in[i] : in[x] != in[i]) {
+						len -= diff;
+						break;
+					}
+					++len;
+				}
+			}
+
+			*out++ = diff ? len - 1 : 0x80 | (len - 1);
+
+			for (i = x; i < x + (diff ? len : 1); ++i, out += 4)
+				__write32(out, in[i]);
+		}
+
+		fwrite(row, 1, out - row, fp);
+	}
+
+	free(row);
+
+	return 0;
+}
+
+extern int
+image_clip(int iw, int ih, int *x, int *y, int *w, int *h)
+{
+	if (*x < 0) *w += *x, *x = 0;
+	if (*y < 0) *h += *y, *y = 0;
+
+	*w = MIN(*w, iw - *x);
+	*h = MIN(*h, ih - *y);
+
+	return *w > 0 && *h > 0 ? 0 : -1;
+}
+
+extern int
+image_read(FILE *fp, int rx, int ry, int rw, int rh,
+		ImageAllocator alloc, void *ctx, Image_t *img)
+{
+	int x, y, w, h;
+	unsigned char hdr[16], *data, *px;
+	size_t hdrlen, len;
+
+	memset(img, 0, sizeof(*img));
+	hdrlen = fread(hdr, 1, sizeof(hdr), fp);
+
+	/* farbfeld is streamed row by row, everything */
+	/* else is read into memory and decoded there; */
+	/* either way only the region is allocated */
+	if (hdrlen == sizeof(hdr) && memcmp(hdr, "farbfeld", 8) == 0) {
+		w = (int)((uint32_t)hdr[8]<<24 | hdr[9]<<16 | hdr[10]<<8 | hdr[11]);
+		h = (int)((uint32_t)hdr[12]<<24 | hdr[13]<<16 | hdr[14]<<8 | hdr[15]);
+
+		if (w < 1 || h < 1 || (uint64_t)w*h > SIZE_MAX/4 ||
+				image_clip(w, h, &rx, &ry, &rw, &rh) < 0)
+			return -1;
+
+		if (__image_alloc(img, alloc, ctx, rw, rh) < 0)
+			return -1;
+
+		return __image_read_farbfeld(img, fp, w, rx, ry);
+	}
+
+	if (NULL == (data = __read_all(fp, hdr, hdrlen, &len)))
+		return -1;
+
+	/* qoi decodes straight into the pixels, no repacking needed */
+	if (qoi_info(data, len, &w, &h) == 0) {
+		if (image_clip(w, h, &rx, &ry, &rw, &rh) < 0) {
+			free(data);
+			return -1;
+		}
+
+		x = __image_alloc(img, alloc, ctx, rw, rh) < 0 ? -1 :
+			qoi_decode(data, len, img->px, rw, rx, ry, rw, rh);
+		free(data);
+
+		return x;
+	}
+
+	/* as does jpeg, which keeps the file for later crops */
+	if (jpg_is_jpeg(data, len) && jpg_info(data, len, &w, &h) == 0) {
+		if (image_clip(w, h, &rx, &ry, &rw, &rh) < 0) {
+			free(data);
+			return -1;
+		}
+
+		if (__image_alloc(img, alloc, ctx, rw, rh) < 0) {
+			free(data);
+			return -1;
+		}
+
+		if (jpg_decode(data, len, img->px, rw, rx, ry, rw, rh) == 0) {
+			img->jpg.data = data;
+			img->jpg.len = len;
+			img->jpg.x = rx;
+			img->jpg.y = ry;
+			return 0;
+		}
+
+		/* stb might still read it, into the same pixels */
+	}
+
+	px = len > INT_MAX ? NULL : stbi_load_from_memory(data, len, &w, &h, NULL, 4);
+	free(data);
+
+	if (NULL == px || image_clip(w, h, &rx, &ry, &rw, &rh) < 0 ||
+			(NULL != img->px && (rw != img->width || rh != img->height))) {
+		free(px);
+		return -1;
+	}
+
+	/* stb can't stop early, the region is cut once decoded */
+	if (NULL == img->px && __image_alloc(img, alloc, ctx, rw, rh) < 0) {
+		free(px);
+		return -1;
+	}
+
+	for (y = 0; y < rh; ++y)
+		for (x = 0; x < rw; ++x)
+			img->px[(size_t)y*rw+x] = __pack_color(&px[((size_t)(ry+y)*w+rx+x)*4]);
+
+	free(px);
+
+	return 0;
+}
+
+extern int
+image_write(const Image_t *img, const char *path, FILE *fp)
+{
+	int rc;
+
+	if (fp == stdout || __path_has_ext(path, ".ff")) {
+		rc = __image_write_farbfeld(img, fp);
+	} else if (__path_has_ext(path, ".qoi")) {
+		rc = qoi_write(fp, img->px, img->width, img->height, img->stride);
+	} else if (__path_is_jpg(path)) {
+		/* a jpeg that was only cropped gets its dct */
+		/* coefficients copied instead of re-encoded */
+		if (NULL == img->jpg.data || (rc = jpg_crop(img->jpg.data, img->jpg.len,
+					img->jpg.x, img->jpg.y, img->width, img->height, fp)) < 0)
+			rc = jpg_write(fp, img->px, img->width, img->height, img->stride, 100);
+	} else if (__path_has_ext(path, ".bmp")) {
+		rc = __image_write_bmp(img, fp);
+	} else if (__path_has_ext(path, ".tga")) {
+		rc = __image_write_tga(img, fp);
+	} else {
+		rc = png_write(fp, img->px, img->width, img->height, img->stride);
+	}
+
+	return rc < 0 || ferror(fp) ? -1 : 0;
+}
+
+extern unsigned char *
+image_rgba(const Image_t *img)
+{
+	unsigned char *px;
+	int x, y;
+
+	if (NULL == (px = malloc((size_t)img->width*img->height*4)))
+		return NULL;
+
+	for (y = 0; y < img->height; ++y)
+		for (x = 0; x < img->width; ++x)
+			__unpack_color(img->px[(size_t)y*img->stride+x], &px[((size_t)y*img->width+x)*4]);
+
+	return px;
+}
+
+extern void
+image_grayscale_pixels(uint32_t *px, int stride, int w, int h)
+{
+	uint32_t col;
+	int x, y, gray;
+
+	for (y = 0; y < h; ++y) {
+		for (x = 0; x < w; ++x) {
+			col = px[(size_t)y*stride+x];
+			gray = ((col & 0xff) + ((col >> 8) & 0xff) + ((col >> 16) & 0xff)) / 3;
+			px[(size_t)y*stride+x] = (col & 0xff000000) | (gray) | (gray << 8) | (gray << 16);
+		}
+	}
+}
+
+static uint32_t *
+__blur_passes(uint32_t *blur_area, uint32_t *blur_area_previous,
+		int w, int h, int strength)
+{
+	int dx, dy;
+	int pass;
+	int numpx, r, g, b, kdx, kdy;
+	uint32_t *tmp;
+
+	for (pass = 0; pass < strength; ++pass) {
+		tmp = blur_area_previous;
+		blur_area_previous = blur_area;
+		blur_area = tmp;
+
+		for (dy = 0; dy < h; ++dy) {
+			for (dx = 0; dx < w; ++dx) {
+				numpx = r = g = b = 0;
+				for (kdy = -IMAGE_BLUR_RADIUS; kdy <= IMAGE_BLUR_RADIUS; ++kdy) {
+					if ((dy+kdy) < 0 || (dy+kdy) >= h) continue;
+					for (kdx = -IMAGE_BLUR_RADIUS; kdx <= IMAGE_BLUR_RADIUS; ++kdx) {
+						if ((dx+kdx) < 0 || (dx+kdx) >= w) continue;
+						r += RED(blur_area_previous[(size_t)(dy+kdy)*w+dx+kdx]);
+						g += GREEN(blur_area_previous[(size_t)(dy+kdy)*w+dx+kdx]);
+						b += BLUE(blur_area_previous[(size_t)(dy+kdy)*w+dx+kdx]);
+						numpx++;
+					}
+				}
+				blur_area[(size_t)dy*w+dx] = ((blur_area_previous[(size_t)dy*w+dx])&0xff000000) |
+									 ((r/numpx)<<16) |
+									 ((g/numpx)<<8) |
+									 (b/numpx);
+			}
+		}
+	}
+
+	return blur_area;
+}
+
+extern int
+image_blur_pixels(uint32_t *px, int stride, int w, int h, int strength)
+{
+	int halo, rows, y, y0, y1, wy0, wy1;
+	uint32_t *area, *carry, *out;
+
+	if (strength < 1)
+		return -1;
+
+	if (w < 1 || h < 1)
+		return 0;
+
+	/* every pass reaches IMAGE_BLUR_RADIUS rows further, so */
+	/* a band blurred with that many rows per pass around it */
+	/* comes out as if the whole area had been blurred at once */
+	halo = IMAGE_BLUR_RADIUS * strength;
+	rows = MIN(h, MAX(4*halo, IMAGE_BLUR_BAND_PIXELS / w));
+
+	area = malloc((size_t)8*w*MIN(h, rows + 2*halo));
+	carry = rows < h ? malloc((size_t)4*w*halo) : NULL;
+
+	if (NULL == area || (rows < h && NULL == carry)) {
+		free(carry);
+		free(area);
+		return -1;
+	}
+
+	for (y0 = 0; y0 < h; y0 = y1) {
+		y1 = MIN(h, y0 + rows);
+		wy0 = MAX(0, y0 - halo);
+		wy1 = MIN(h, y1 + halo);
+
+		/* the rows above were blurred by the band before, */
+		/* which kept their original pixels aside */
+		for (y = wy0; y < wy1; ++y)
+			memcpy(&area[(size_t)(y - wy0)*w], y < y0 ?
+					&carry[(size_t)(y - y0 + halo)*w] :
+					&px[(size_t)y*stride], (size_t)4*w);
+
+		out = __blur_passes(area, &area[(size_t)(wy1 - wy0)*w],
+				w, wy1 - wy0, strength);
+
+		if (y1 < h)
+			for (y = y1 - halo; y < y1; ++y)
+				memcpy(&carry[(size_t)(y - y1 + halo)*w],
+						&px[(size_t)y*stride], (size_t)4*w);
+
+		for (y = y0; y < y1; ++y)
+			memcpy(&px[(size_t)y*stride], &out[(size_t)(y - wy0)*w],
+					(size_t)4*w);
+	}
+
+	free(carry);
+	free(area);
+
+	return 0;
+}
+
+extern Image_t *
+image_load(const char *path, int x, int y, int w, int h)
+{
+	FILE *fp;
+	Image_t *img;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdin;
+	else if (NULL == (fp = fopen(path, "rb")))
+		return NULL;
+
+	if (NULL == (img = malloc(sizeof(Image_t)))) {
+		if (fp != stdin)
+			fclose(fp);
+		return NULL;
+	}
+
+	if (image_read(fp, x, y, w, h, __image_malloc, NULL, img) < 0) {
+		free(img->px);
+		free(img);
+		img = NULL;
+	} else {
+		img->buf = img->px;
+	}
+
+	if (fp != stdin)
+		fclose(fp);
+
+	return img;
+}
+
+extern int
+image_save(const Image_t *img, const char *path)
+{
+	FILE *fp;
+	int rc;
+
+	if (strcmp(path, "-") == 0)
+		fp = stdout;
+	else if (NULL == (fp = fopen(path, "wb")))
+		return -1;
+
+	rc = image_write(img, path, fp);
+
+	if (fp == stdout)
+		rc = fflush(fp) == 0 ? rc : -1;
+	else
+		rc = fclose(fp) == 0 ? rc : -1;
+
+	return rc;
+}
+
+extern void
+image_crop(Image_t *img, int x, int y, int w, int h)
+{
+	if (image_clip(img->width, img->height, &x, &y, &w, &h) < 0)
+		return;
+
+	/* only the view moves, as in the canvas */
+	img->px += (size_t)y*img->stride + x;
+	img->width = w;
+	img->height = h;
+	img->jpg.x += x;
+	img->jpg.y += y;
+}
+
+static void
+__image_lose_jpg(Image_t *img)
+{
+	/* edited pixels can't come from the jpeg anymore */
+	free(img->jpg.data);
+	img->jpg.data = NULL;
+}
+
+extern void
+image_grayscale(Image_t *img, int x, int y, int w, int h)
+{
+	if (image_clip(img->width, img->height, &x, &y, &w, &h) < 0)
+		return;
+
+	__image_lose_jpg(img);
+	image_grayscale_pixels(&img->px[(size_t)y*img->stride+x], img->stride, w, h);
+}
+
+extern int
+image_blur(Image_t *img, int x, int y, int w, int h, int strength)
+{
+	if (strength < 1)
+		return -1;
+
+	if (image_clip(img->width, img->height, &x, &y, &w, &h) < 0)
+		return 0;
+
+	__image_lose_jpg(img);
+
+	return image_blur_pixels(&img->px[(size_t)y*img->stride+x], img->stride,
+			w, h, strength);
+}
+
+extern Image_t *
+image_copy(const Image_t *img)
+{
+	Image_t *copy;
+	int y;
+
+	if (NULL == (copy = malloc(sizeof(Image_t))))
+		return NULL;
+
+	memset(copy, 0, sizeof(*copy));
+	copy->width = copy->stride = img->width;
+	copy->height = img->height;
+
+	if (NULL == (copy->px = malloc((size_t)img->width*img->height*4))) {
+		free(copy);
+		return NULL;
+	}
+
+	for (y = 0; y < img->height; ++y)
+		memcpy(&copy->px[(size_t)y*copy->stride],
+				&img->px[(size_t)y*img->stride], (size_t)4*img->width);
+
+	copy->buf = copy->px;
+
+	return copy;
+}
+
+extern void
+image_free(Image_t *img)
+{
+	free(img->buf);
+	free(img->jpg.data);
+	free(img);
+}
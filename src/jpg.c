@@ -0,0 +1,324 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "jpg.h"
+
+#define DIV_ROUND_UP(a,b) (((a)+(b)-1)/(b))
+#define ROUND_UP(a,b) (DIV_ROUND_UP(a,b)*(b))
+
+struct jpg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf env;
+};
+
+static void
+__error_exit(j_common_ptr cinfo)
+{
+	longjmp(((struct jpg_error *)(cinfo->err))->env, 1);
+}
+
+static JDIMENSION
+__blocks(int px, int samp, int imcu)
+{
+	/* same sizing libjpeg uses for the coefficient arrays */
+	return ROUND_UP(DIV_ROUND_UP((long)px * samp, imcu), samp);
+}
+
+extern int
+jpg_is_jpeg(const unsigned char *data, size_t len)
+{
+	return len > 3 && data[0] == 0xff && data[1] == 0xd8 && data[2] == 0xff;
+}
+
+extern int
+jpg_info(const unsigned char *data, size_t len, int *w, int *h)
+{
+	struct jpeg_decompress_struct src;
+	struct jpg_error err;
+
+	src.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = __error_exit;
+
+	jpeg_create_decompress(&src);
+
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&src);
+		return -1;
+	}
+
+	jpeg_mem_src(&src, data, len);
+	jpeg_read_header(&src, TRUE);
+
+	*w = src.image_width;
+	*h = src.image_height;
+
+	jpeg_destroy_decompress(&src);
+
+	return 0;
+}
+
+extern int
+jpg_decode(const unsigned char *data, size_t len, uint32_t *px, int stride,
+		int x, int y, int w, int h)
+{
+	struct jpeg_decompress_struct src;
+	struct jpg_error err;
+	JSAMPARRAY row;
+	JDIMENSION i, left;
+	uint32_t *out;
+	JSAMPLE *p;
+
+	src.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = __error_exit;
+
+	jpeg_create_decompress(&src);
+
+	if (setjmp(err.env)) {
+		jpeg_destroy_decompress(&src);
+		return -1;
+	}
+
+	jpeg_mem_src(&src, data, len);
+	jpeg_read_header(&src, TRUE);
+
+	if (x < 0 || y < 0 || w < 1 || h < 1 ||
+			(JDIMENSION)(x + w) > src.image_width ||
+			(JDIMENSION)(y + h) > src.image_height) {
+		jpeg_destroy_decompress(&src);
+		return -1;
+	}
+
+	src.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&src);
+
+	left = x;
+
+#ifdef LIBJPEG_TURBO_VERSION
+	/* imcu columns out of the region aren't decoded at all, */
+	/* the crop only widens it to their boundaries */
+	{
+		JDIMENSION width = w;
+		jpeg_crop_scanline(&src, &left, &width);
+		left = x - left;
+	}
+#endif
+
+	/* one scanline at a time, the image is never whole in memory */
+	row = (*src.mem->alloc_sarray)((j_common_ptr)(&src), JPOOL_IMAGE,
+			src.output_width * 3, 1);
+
+#ifdef LIBJPEG_TURBO_VERSION
+	jpeg_skip_scanlines(&src, y);
+#else
+	while (src.output_scanline < (JDIMENSION)y)
+		jpeg_read_scanlines(&src, row, 1);
+#endif
+
+	while (src.output_scanline < (JDIMENSION)(y + h)) {
+		out = &px[(size_t)(src.output_scanline - y)*stride];
+		jpeg_read_scanlines(&src, row, 1);
+		for (i = 0, p = &row[0][left*3]; i < (JDIMENSION)w; ++i, p += 3)
+			out[i] = 0xff000000 | (uint32_t)p[0]<<16 | p[1]<<8 | p[2];
+	}
+
+	/* the rows below the region are left undecoded */
+	jpeg_destroy_decompress(&src);
+
+	return 0;
+}
+
+static int
+__crop_coefficients(struct jpeg_decompress_struct *src,
+		struct jpeg_compress_struct *dst, int x, int y, int w, int h)
+{
+	jvirt_barray_ptr *src_coefs, *dst_coefs;
+	jpeg_component_info *comp;
+	JBLOCKARRAY src_rows, dst_rows;
+	JDIMENSION xoff, yoff, row;
+	int ci, r, imcu_w, imcu_h;
+
+	imcu_w = src->max_h_samp_factor * DCTSIZE;
+	imcu_h = src->max_v_samp_factor * DCTSIZE;
+
+	/* coefficients can only be moved in whole iMCUs, a crop */
+	/* starting elsewhere has to be re-encoded by the caller */
+	if (x % imcu_w != 0 || y % imcu_h != 0)
+		return -1;
+
+	if (x < 0 || y < 0 || w < 1 || h < 1 ||
+			(JDIMENSION)(x + w) > src->image_width ||
+			(JDIMENSION)(y + h) > src->image_height)
+		return -1;
+
+	/* the destination arrays have to be requested before */
+	/* reading the coefficients, that's when they get realized */
+	dst_coefs = (*src->mem->alloc_small)((j_common_ptr)(src), JPOOL_IMAGE,
+			sizeof(jvirt_barray_ptr) * src->num_components);
+
+	for (ci = 0; ci < src->num_components; ++ci) {
+		comp = &src->comp_info[ci];
+		dst_coefs[ci] = (*src->mem->request_virt_barray)(
+				(j_common_ptr)(src), JPOOL_IMAGE, FALSE,
+				__blocks(w, comp->h_samp_factor, imcu_w),
+				__blocks(h, comp->v_samp_factor, imcu_h),
+				comp->v_samp_factor);
+	}
+
+	src_coefs = jpeg_read_coefficients(src);
+
+	jpeg_copy_critical_parameters(src, dst);
+	dst->image_width = w;
+	dst->image_height = h;
+	dst->optimize_coding = TRUE;
+
+	jpeg_write_coefficients(dst, dst_coefs);
+
+	for (ci = 0; ci < src->num_components; ++ci) {
+		comp = &src->comp_info[ci];
+		xoff = x / imcu_w * comp->h_samp_factor;
+		yoff = y / imcu_h * comp->v_samp_factor;
+
+		for (row = 0; row < __blocks(h, comp->v_samp_factor, imcu_h);
+				row += comp->v_samp_factor) {
+			dst_rows = (*src->mem->access_virt_barray)((j_common_ptr)(src),
+					dst_coefs[ci], row, comp->v_samp_factor, TRUE);
+			src_rows = (*src->mem->access_virt_barray)((j_common_ptr)(src),
+					src_coefs[ci], row + yoff, comp->v_samp_factor, FALSE);
+			for (r = 0; r < comp->v_samp_factor; ++r)
+				memcpy(dst_rows[r], src_rows[r] + xoff, sizeof(JBLOCK) *
+						__blocks(w, comp->h_samp_factor, imcu_w));
+		}
+	}
+
+	return 0;
+}
+
+extern int
+jpg_crop(const unsigned char *data, size_t len, int x, int y, int w, int h,
+		FILE *fp)
+{
+	struct jpeg_decompress_struct src;
+	struct jpeg_compress_struct dst;
+	struct jpg_error err;
+	unsigned char *out;
+	unsigned long outlen;
+
+	out = NULL;
+	outlen = 0;
+
+	src.err = jpeg_std_error(&err.mgr);
+	dst.err = &err.mgr;
+	err.mgr.error_exit = __error_exit;
+
+	jpeg_create_decompress(&src);
+	jpeg_create_compress(&dst);
+
+	if (setjmp(err.env)) {
+		jpeg_destroy_compress(&dst);
+		jpeg_destroy_decompress(&src);
+		free(out);
+		return -1;
+	}
+
+	jpeg_mem_src(&src, data, len);
+	jpeg_read_header(&src, TRUE);
+
+	jpeg_mem_dest(&dst, &out, &outlen);
+
+	if (__crop_coefficients(&src, &dst, x, y, w, h) < 0)
+		longjmp(err.env, 1);
+
+	jpeg_finish_compress(&dst);
+	jpeg_destroy_compress(&dst);
+	jpeg_finish_decompress(&src);
+	jpeg_destroy_decompress(&src);
+
+	fwrite(out, 1, outlen, fp);
+	free(out);
+
+	return ferror(fp) ? -1 : 0;
+}
+
+static void
+__write_scanlines(struct jpeg_compress_struct *dst, const uint32_t *px, int stride)
+{
+	JSAMPARRAY row;
+	JDIMENSION i;
+	const uint32_t *in;
+	unsigned char *p;
+
+	/* one scanline at a time, nothing is copied whole */
+	row = (*dst->mem->alloc_sarray)((j_common_ptr)(dst), JPOOL_IMAGE,
+			dst->image_width * 3, 1);
+
+	while (dst->next_scanline < dst->image_height) {
+		in = &px[(size_t)dst->next_scanline*stride];
+		for (i = 0, p = row[0]; i < dst->image_width; ++i, p += 3) {
+			p[0] = (in[i] >> 16) & 0xff;
+			p[1] = (in[i] >> 8) & 0xff;
+			p[2] = in[i] & 0xff;
+		}
+		jpeg_write_scanlines(dst, row, 1);
+	}
+}
+
+extern int
+jpg_write(FILE *fp, const uint32_t *px, int w, int h, int stride, int quality)
+{
+	struct jpeg_compress_struct dst;
+	struct jpg_error err;
+	int ci;
+
+	dst.err = jpeg_std_error(&err.mgr);
+	err.mgr.error_exit = __error_exit;
+
+	jpeg_create_compress(&dst);
+
+	if (setjmp(err.env)) {
+		jpeg_destroy_compress(&dst);
+		return -1;
+	}
+
+	jpeg_stdio_dest(&dst, fp);
+	dst.image_width = w;
+	dst.image_height = h;
+	dst.input_components = 3;
+	dst.in_color_space = JCS_RGB;
+
+	jpeg_set_defaults(&dst);
+	jpeg_set_quality(&dst, quality, TRUE);
+
+	/* high qualities keep full resolution chroma */
+	if (quality > 90)
+		for (ci = 0; ci < dst.num_components; ++ci)
+			dst.comp_info[ci].h_samp_factor = dst.comp_info[ci].v_samp_factor = 1;
+
+	jpeg_start_compress(&dst, TRUE);
+	__write_scanlines(&dst, px, stride);
+	jpeg_finish_compress(&dst);
+	jpeg_destroy_compress(&dst);
+
+	return ferror(fp) ? -1 : 0;
+}
@@ -25,6 +25,8 @@
 #include <unistd.h>
 #include "log.h"
 
+static int always_stderr;
+
 static int
 log_stderr(const char *s)
 {
@@ -58,13 +60,19 @@ log_notify_send(const char *s)
 static void
 log_context_based(const char *s)
 {
-	if (isatty(STDOUT_FILENO)) {
+	if (always_stderr || isatty(STDOUT_FILENO)) {
 		log_stderr(s);
 	} else {
 		log_notify_send(s);
 	}
 }
 
+extern void
+log_use_stderr(void)
+{
+	always_stderr = 1;
+}
+
 extern void
 info(const char *fmt, ...)
 {
@@ -0,0 +1,205 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+/* https://www.w3.org/TR/png/ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#include "png.h"
+
+#define PNG_WRITE_BUFSIZE (64*1024)
+
+/* none, sub, up, average and paeth */
+#define PNG_FILTERS 5
+
+static inline unsigned char *
+__write32(unsigned char *p, uint32_t v)
+{
+	*p++ = v >> 24; *p++ = v >> 16; *p++ = v >> 8; *p++ = v;
+	return p;
+}
+
+static void
+__write_chunk(FILE *fp, const char *type, const unsigned char *data, size_t len)
+{
+	unsigned char hdr[8], crc[4];
+	uLong c;
+
+	__write32(hdr, len);
+	memcpy(&hdr[4], type, 4);
+
+	c = crc32(0L, &hdr[4], 4);
+	__write32(crc, len > 0 ? crc32(c, data, len) : c);
+
+	fwrite(hdr, 1, sizeof(hdr), fp);
+	if (len > 0)
+		fwrite(data, 1, len, fp);
+	fwrite(crc, 1, sizeof(crc), fp);
+}
+
+static inline int
+__paeth(int a, int b, int c)
+{
+	int p, pa, pb, pc;
+
+	p = a + b - c;
+	pa = abs(p - a);
+	pb = abs(p - b);
+	pc = abs(p - c);
+
+	if (pa <= pb && pa <= pc)
+		return a;
+
+	return pb <= pc ? b : c;
+}
+
+static unsigned long
+__filter(unsigned char *out, int type, const unsigned char *cur,
+		const unsigned char *prev, size_t n)
+{
+	unsigned long cost;
+	size_t i;
+	int a, c;
+
+	out[0] = type;
+
+	for (i = 0, cost = 0; i < n; ++i) {
+		a = i >= 4 ? cur[i-4] : 0;
+		c = i >= 4 ? prev[i-4] : 0;
+
+		switch (type) {
+		case 0: out[1+i] = cur[i]; break;
+		case 1: out[1+i] = cur[i] - a; break;
+		case 2: out[1+i] = cur[i] - prev[i]; break;
+		case 3: out[1+i] = cur[i] - ((a + prev[i]) >> 1); break;
+		case 4: out[1+i] = cur[i] - __paeth(a, prev[i], c); break;
+		}
+
+		/* the usual guess at what compresses best, */
+		/* the smallest sum of the bytes as signed */
+		cost += abs((signed char)(out[1+i]));
+	}
+
+	return cost;
+}
+
+static int
+__deflate(z_stream *z, unsigned char *buf, int flush, FILE *fp)
+{
+	int rc;
+
+	/* every time the buffer fills up it goes out as an idat */
+	/* chunk, the last one with whatever is left at the end */
+	do {
+		if ((rc = deflate(z, flush)) == Z_STREAM_ERROR)
+			return -1;
+
+		if (z->avail_out == 0 || (rc == Z_STREAM_END &&
+					z->avail_out < PNG_WRITE_BUFSIZE)) {
+			__write_chunk(fp, "IDAT", buf, PNG_WRITE_BUFSIZE - z->avail_out);
+			z->next_out = buf;
+			z->avail_out = PNG_WRITE_BUFSIZE;
+		}
+	} while (flush == Z_FINISH ? rc != Z_STREAM_END : z->avail_in > 0);
+
+	return 0;
+}
+
+extern int
+png_write(FILE *fp, const uint32_t *px, int w, int h, int stride)
+{
+	static const unsigned char sig[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+	unsigned char ihdr[13] = { 0 }, *rows, *cur, *prev, *filtered, *best, *trial, *buf, *t;
+	unsigned long cost, mincost;
+	const uint32_t *in;
+	z_stream z;
+	size_t n;
+	int x, y, f, rc;
+
+	n = (size_t)w*4;
+	rows = calloc(2, n);
+	filtered = malloc(2*(n + 1));
+	buf = malloc(PNG_WRITE_BUFSIZE);
+
+	memset(&z, 0, sizeof(z));
+
+	if (NULL == rows || NULL == filtered || NULL == buf ||
+			deflateInit(&z, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		free(buf);
+		free(filtered);
+		free(rows);
+		return -1;
+	}
+
+	z.next_out = buf;
+	z.avail_out = PNG_WRITE_BUFSIZE;
+
+	__write32(&ihdr[0], w);
+	__write32(&ihdr[4], h);
+	ihdr[8] = 8; /* bits per channel */
+	ihdr[9] = 6; /* truecolor with alpha */
+
+	fwrite(sig, 1, sizeof(sig), fp);
+	__write_chunk(fp, "IHDR", ihdr, sizeof(ihdr));
+
+	/* the row above the first one counts as all zeros */
+	prev = rows;
+	cur = &rows[n];
+	rc = 0;
+
+	for (y = 0; y < h && rc == 0; ++y) {
+		in = &px[(size_t)y*stride];
+		for (x = 0; x < w; ++x) {
+			cur[x*4+0] = (in[x] >> 16) & 0xff;
+			cur[x*4+1] = (in[x] >> 8) & 0xff;
+			cur[x*4+2] = in[x] & 0xff;
+			cur[x*4+3] = (in[x] >> 24) & 0xff;
+		}
+
+		best = filtered;
+		trial = &filtered[n + 1];
+		mincost = __filter(best, 0, cur, prev, n);
+
+		for (f = 1; f < PNG_FILTERS; ++f) {
+			if ((cost = __filter(trial, f, cur, prev, n)) < mincost) {
+				mincost = cost;
+				t = best; best = trial; trial = t;
+			}
+		}
+
+		z.next_in = best;
+		z.avail_in = n + 1;
+		rc = __deflate(&z, buf, Z_NO_FLUSH, fp);
+
+		t = prev; prev = cur; cur = t;
+	}
+
+	if (rc == 0 && (rc = __deflate(&z, buf, Z_FINISH, fp)) == 0)
+		__write_chunk(fp, "IEND", NULL, 0);
+
+	deflateEnd(&z);
+	free(buf);
+	free(filtered);
+	free(rows);
+
+	return rc < 0 || ferror(fp) ? -1 : 0;
+}
@@ -0,0 +1,260 @@
+/*
+	Copyright (C) 2025 <alpheratz99@protonmail.com>
+
+	This program is free software; you can redistribute it and/or modify it
+	under the terms of the GNU General Public License version 2 as published by
+	the Free Software Foundation.
+
+	This program is distributed in the hope that it will be useful, but WITHOUT
+	ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+	FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+	more details.
+
+	You should have received a copy of the GNU General Public License along
+	with this program; if not, write to the Free Software Foundation, Inc., 59
+	Temple Place, Suite 330, Boston, MA 02111-1307 USA
+
+*/
+
+/* https://qoiformat.org/qoi-specification.pdf */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "qoi.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+#define QOI_MASK_2   0xc0
+
+#define QOI_HEADER_SIZE 14
+#define QOI_PADDING_SIZE 8
+#define QOI_PIXELS_MAX 400000000
+
+#define QOI_WRITE_BUFSIZE (64*1024)
+
+#define A(c) ((c>>24) & 0xff)
+#define R(c) ((c>>16) & 0xff)
+#define G(c) ((c>>8) & 0xff)
+#define B(c) ((c>>0) & 0xff)
+
+#define QOI_HASH(c) ((R(c)*3 + G(c)*5 + B(c)*7 + A(c)*11) & 63)
+
+static inline uint32_t
+__read32(const unsigned char *p)
+{
+	return (uint32_t)p[0]<<24 | (uint32_t)p[1]<<16 | (uint32_t)p[2]<<8 | p[3];
+}
+
+static inline unsigned char *
+__write32(unsigned char *p, uint32_t v)
+{
+	*p++ = v >> 24; *p++ = v >> 16; *p++ = v >> 8; *p++ = v;
+	return p;
+}
+
+static inline uint32_t
+__add(uint32_t c, int dr, int dg, int db)
+{
+	return (c & 0xff000000) |
+		((R(c) + dr) & 0xff) << 16 |
+		((G(c) + dg) & 0xff) << 8 |
+		((B(c) + db) & 0xff);
+}
+
+extern int
+qoi_info(const unsigned char *data, size_t len, int *w, int *h)
+{
+	uint32_t width, height;
+
+	if (len < QOI_HEADER_SIZE + QOI_PADDING_SIZE ||
+			data[0] != 'q' || data[1] != 'o' ||
+			data[2] != 'i' || data[3] != 'f')
+		return -1;
+
+	width = __read32(&data[4]);
+	height = __read32(&data[8]);
+
+	if (width == 0 || height == 0 || width > INT_MAX || height > INT_MAX ||
+			(data[12] != 3 && data[12] != 4) || data[13] > 1 ||
+			(uint64_t)width * height > QOI_PIXELS_MAX)
+		return -1;
+
+	*w = width;
+	*h = height;
+
+	return 0;
+}
+
+extern int
+qoi_decode(const unsigned char *data, size_t len, uint32_t *px, int stride,
+		int x, int y, int w, int h)
+{
+	const unsigned char *in, *end;
+	uint32_t index[64] = { 0 };
+	uint32_t p, *row;
+	int iw, ih, i, j, b1, b2, vg, run;
+
+	if (qoi_info(data, len, &iw, &ih) < 0 || x < 0 || y < 0 ||
+			w < 1 || h < 1 || x + w > iw || y + h > ih)
+		return -1;
+
+	in = data + QOI_HEADER_SIZE;
+	end = data + len - QOI_PADDING_SIZE;
+	p = 0xff000000;
+	run = 0;
+
+	/* every pixel depends on the ones before it, so all rows */
+	/* up to the region are decoded, but only the region is kept */
+	for (j = 0; j < y + h; ++j) {
+		row = j < y ? NULL : &px[(size_t)(j - y)*stride];
+		for (i = 0; i < iw; ++i) {
+			if (run > 0) {
+				if (NULL != row && i >= x && i < x + w)
+					row[i - x] = p;
+				--run;
+				continue;
+			}
+
+			/* the longest op is 5 bytes and the padding */
+			/* is 8, so reading an op never goes past len */
+			if (in >= end)
+				return -1;
+
+			b1 = *in++;
+
+			if (b1 == QOI_OP_RGB) {
+				p = (p & 0xff000000) | (uint32_t)in[0]<<16 | in[1]<<8 | in[2];
+				in += 3;
+			} else if (b1 == QOI_OP_RGBA) {
+				p = (uint32_t)in[3]<<24 | (uint32_t)in[0]<<16 | in[1]<<8 | in[2];
+				in += 4;
+			} else {
+				switch (b1 & QOI_MASK_2) {
+				case QOI_OP_INDEX:
+					p = index[b1];
+					break;
+				case QOI_OP_DIFF:
+					p = __add(p, ((b1>>4) & 3) - 2,
+							((b1>>2) & 3) - 2, (b1 & 3) - 2);
+					break;
+				case QOI_OP_LUMA:
+					b2 = *in++;
+					vg = (b1 & 0x3f) - 32;
+					p = __add(p, vg - 8 + ((b2>>4) & 0x0f),
+							vg, vg - 8 + (b2 & 0x0f));
+					break;
+				case QOI_OP_RUN:
+					run = b1 & 0x3f;
+					break;
+				}
+			}
+
+			index[QOI_HASH(p)] = p;
+
+			if (NULL != row && i >= x && i < x + w)
+				row[i - x] = p;
+		}
+	}
+
+	return 0;
+}
+
+extern int
+qoi_write(FILE *fp, const uint32_t *px, int w, int h, int stride)
+{
+	unsigned char buf[QOI_WRITE_BUFSIZE], *out;
+	uint32_t index[64] = { 0 };
+	uint32_t p, prev;
+	const uint32_t *row;
+	int x, y, run, hash;
+	signed char vr, vg, vb, vg_r, vg_b;
+
+	out = buf;
+	*out++ = 'q'; *out++ = 'o'; *out++ = 'i'; *out++ = 'f';
+	out = __write32(out, w);
+	out = __write32(out, h);
+	*out++ = 4; /* channels */
+	*out++ = 0; /* colorspace: sRGB with linear alpha */
+
+	prev = 0xff000000;
+	run = 0;
+
+	for (y = 0; y < h; ++y) {
+		row = &px[(size_t)y*stride];
+		for (x = 0; x < w; ++x) {
+			p = row[x];
+
+			if (p == prev) {
+				if (++run == 62) {
+					*out++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+			} else {
+				if (run > 0) {
+					*out++ = QOI_OP_RUN | (run - 1);
+					run = 0;
+				}
+
+				hash = QOI_HASH(p);
+
+				if (index[hash] == p) {
+					*out++ = QOI_OP_INDEX | hash;
+				} else {
+					index[hash] = p;
+
+					if (A(p) == A(prev)) {
+						vr = R(p) - R(prev);
+						vg = G(p) - G(prev);
+						vb = B(p) - B(prev);
+						vg_r = vr - vg;
+						vg_b = vb - vg;
+
+						if (vr > -3 && vr < 2 && vg > -3 &&
+								vg < 2 && vb > -3 && vb < 2) {
+							*out++ = QOI_OP_DIFF | (vr + 2) << 4 |
+								(vg + 2) << 2 | (vb + 2);
+						} else if (vg_r > -9 && vg_r < 8 && vg > -33 &&
+								vg < 32 && vg_b > -9 && vg_b < 8) {
+							*out++ = QOI_OP_LUMA | (vg + 32);
+							*out++ = (vg_r + 8) << 4 | (vg_b + 8);
+						} else {
+							*out++ = QOI_OP_RGB;
+							*out++ = R(p); *out++ = G(p); *out++ = B(p);
+						}
+					} else {
+						*out++ = QOI_OP_RGBA;
+						*out++ = R(p); *out++ = G(p);
+						*out++ = B(p); *out++ = A(p);
+					}
+				}
+
+				prev = p;
+			}
+
+			/* leave room for the next op, a pending run and the padding */
+			if (out - buf > QOI_WRITE_BUFSIZE - 16) {
+				fwrite(buf, 1, out - buf, fp);
+				out = buf;
+			}
+		}
+	}
+
+	if (run > 0)
+		*out++ = QOI_OP_RUN | (run - 1);
+
+	for (x = 0; x < QOI_PADDING_SIZE - 1; ++x)
+		*out++ = 0;
+
+	*out++ = 1;
+
+	fwrite(buf, 1, out - buf, fp);
+
+	return ferror(fp) ? -1 : 0;
+}
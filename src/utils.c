@@ -52,6 +52,14 @@ xcalloc(size_t nmemb, size_t size)
 	return ptr;
 }
 
+extern void *
+xrealloc(void *ptr, size_t size)
+{
+	if (NULL == (ptr = realloc(ptr, size)))
+		die("OOM");
+	return ptr;
+}
+
 extern char *
 xstrdup(const char *str)
 {
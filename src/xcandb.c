@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -30,13 +31,17 @@
 
 #include "utils.h"
 #include "canvas.h"
+#include "image.h"
+#include "batch.h"
+#include "clipboard.h"
 #include "log.h"
 
-#define MIN(a,b) ((a)<(b)?(a):(b))
-#define MAX(a,b) ((a)>(b)?(a):(b))
-
 #define XCANDB_WM_NAME "xcandb"
 #define XCANDB_WM_CLASS "xcandb\0xcandb\0"
+#define XCANDB_BACKGROUND 0x1e1e1e
+#define XCANDB_ZOOM_STEP 1.25f
+#define XCANDB_BLUR_STRENGTH 10
+#define XCANDB_EDITS_MAX 64
 
 typedef struct {
 	bool active;
@@ -60,7 +65,6 @@ static Canvas_t *canvas;
 static xcb_connection_t *conn;
 static xcb_screen_t *scr;
 static xcb_window_t win;
-static xcb_gcontext_t rect_gc;
 static xcb_key_symbols_t *ksyms;
 static xcb_cursor_context_t *cctx;
 static xcb_cursor_t cursor_hand;
@@ -71,7 +75,27 @@ static DragInfo_t drag;
 static CropInfo_t crop;
 static BlurInfo_t blur;
 static bool start_in_fullscreen;
+static bool background_pixmap;
+static bool xrender_zoom;
+static bool edit_list;
+static size_t history_budget = CANVAS_HISTORY_BUDGET;
+static struct {
+	int x, y;
+	int width, height;
+} region = { 0, 0, INT_MAX, INT_MAX };
+static bool capture;
+static xcb_window_t capture_window;
+static int nedits;
+static Edit_t edits[XCANDB_EDITS_MAX];
+static bool batch;
+static const char *savepath;
 static bool should_close;
+static bool render_pending;
+static struct {
+	bool pending;
+	int16_t x;
+	int16_t y;
+} motion;
 
 static xcb_atom_t
 get_x11_atom(const char *name)
@@ -129,14 +153,13 @@ xwininit(void)
 	cursor_watch = xcb_cursor_load_cursor(cctx, "watch");
 	ksyms = xcb_key_symbols_alloc(conn);
 	win = xcb_generate_id(conn);
-	rect_gc = xcb_generate_id(conn);
 
 	xcb_create_window_aux(
 		conn, scr->root_depth, win, scr->root, 0, 0,
 		800, 600, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
 		scr->root_visual, XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
 		(const xcb_create_window_value_list_t []) {{
-			.background_pixel = 0x1e1e1e,
+			.background_pixel = XCANDB_BACKGROUND,
 			.event_mask = XCB_EVENT_MASK_EXPOSURE |
 			              XCB_EVENT_MASK_KEY_PRESS |
 			              XCB_EVENT_MASK_BUTTON_PRESS |
@@ -175,9 +198,6 @@ xwininit(void)
 			_NET_WM_STATE, XCB_ATOM_ATOM, 32, 1, &_NET_WM_STATE_FULLSCREEN);
 	}
 
-	xcb_create_gc(conn, rect_gc, win, XCB_GC_FOREGROUND | XCB_GC_LINE_STYLE,
-			(const uint32_t []) { 0xffffff, XCB_LINE_STYLE_DOUBLE_DASH });
-
 	xcb_xkb_use_extension(conn, XCB_XKB_MAJOR_VERSION, XCB_XKB_MINOR_VERSION);
 
 	xcb_xkb_per_client_flags(
@@ -186,14 +206,11 @@ xwininit(void)
 	);
 
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_arrow);
-	xcb_map_window(conn, win);
-	xcb_flush(conn);
 }
 
 static void
 xwindestroy(void)
 {
-	xcb_free_gc(conn, rect_gc);
 	xcb_free_cursor(conn, cursor_hand);
 	xcb_free_cursor(conn, cursor_arrow);
 	xcb_free_cursor(conn, cursor_crosshair);
@@ -209,16 +226,28 @@ save(void)
 {
 	char *path, *expanded_path;
 
-	if (NULL == (path = xprompt("save as...")))
+	/* writing to stdout ends the session, the reader */
+	/* on the other side of the pipe waits for eof */
+	if (NULL != savepath && strcmp(savepath, "-") == 0) {
+		if (canvas_save(canvas, savepath) < 0)
+			die("could not write the image to stdout");
+		should_close = true;
+		return;
+	}
+
+	if (NULL != savepath)
+		path = xstrdup(savepath);
+	else if (NULL == (path = xprompt("save as...")))
 		return;
 
 	if (NULL == (expanded_path = path_expand(path))) {
 		info("could not expand path");
 	} else if (!path_is_writeable(expanded_path)) {
 		info("can't save to %s", path);
+	} else if (canvas_save(canvas, expanded_path) < 0) {
+		info("could not save the image to %s", path);
 	} else {
-		canvas_save(canvas, expanded_path);
-		info("saved image succesfully to %s", path);
+		info("saved image successfully to %s", path);
 	}
 
 	free(path);
@@ -242,10 +271,64 @@ rect_from_two_points(xcb_point_t p1, xcb_point_t p2)
 }
 
 static void
-draw_dashed_rectangle(xcb_point_t a, xcb_point_t b)
+update_selection(void)
+{
+	xcb_rectangle_t r;
+
+	/* the outline is drawn into the canvas frame, so it */
+	/* never shows up on screen without the image under it */
+	if (crop.active)
+		r = rect_from_two_points(crop.start, crop.end);
+	else if (blur.active)
+		r = rect_from_two_points(blur.start, blur.end);
+
+	canvas_set_selection(canvas, crop.active || blur.active ? &r : NULL);
+	render_pending = true;
+}
+
+static void
+viewport_rect_to_canvas(xcb_rectangle_t r, int *x, int *y, int *w, int *h)
 {
-	xcb_poly_rectangle(conn, win, rect_gc, 1,
-			(const xcb_rectangle_t []) { rect_from_two_points(a, b)});
+	int x1, y1;
+
+	/* both corners, the size scales with the zoom too */
+	canvas_viewport_to_canvas_pos(canvas, r.x, r.y, x, y);
+	canvas_viewport_to_canvas_pos(canvas, r.x + r.width, r.y + r.height, &x1, &y1);
+
+	*w = x1 - *x;
+	*h = y1 - *y;
+}
+
+static void
+undo(void)
+{
+	if (crop.active || blur.active || drag.active)
+		return;
+	if (canvas_undo(canvas))
+		render_pending = true;
+}
+
+static void
+redo(void)
+{
+	if (crop.active || blur.active || drag.active)
+		return;
+	if (canvas_redo(canvas))
+		render_pending = true;
+}
+
+static void
+copy(xcb_timestamp_t time)
+{
+	if (clipboard_own(canvas, time) < 0)
+		info("could not take the clipboard");
+}
+
+static void
+zoom(float factor, int16_t x, int16_t y)
+{
+	canvas_set_zoom(canvas, factor * canvas_get_zoom(canvas), x, y);
+	render_pending = true;
 }
 
 static void
@@ -275,7 +358,7 @@ drag_update(int16_t x, int16_t y)
 	drag.y = y;
 
 	canvas_move_relative(canvas, dx, dy);
-	canvas_render(canvas);
+	render_pending = true;
 }
 
 static void
@@ -300,6 +383,8 @@ crop_begin(int16_t x, int16_t y)
 	crop.start.x = crop.end.x = x;
 	crop.start.y = crop.end.y = y;
 
+	update_selection();
+
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_crosshair);
 	xcb_flush(conn);
 }
@@ -313,27 +398,26 @@ crop_update(int16_t x, int16_t y)
 	crop.end.x = x;
 	crop.end.y = y;
 
-	canvas_render(canvas);
-	draw_dashed_rectangle(crop.start, crop.end);
-	xcb_flush(conn);
+	update_selection();
 }
 
 static void
 crop_end(void)
 {
 	xcb_rectangle_t crop_rect;
-	int x, y;
+	int x, y, w, h;
 
 	if (!crop.active)
 		return;
 
 	crop.active = false;
 	crop_rect = rect_from_two_points(crop.start, crop.end);
+	update_selection();
 
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_arrow);
-	canvas_viewport_to_canvas_pos(canvas, crop_rect.x, crop_rect.y, &x, &y);
-	canvas_crop(canvas, x, y, crop_rect.width, crop_rect.height);
-	canvas_render(canvas);
+	viewport_rect_to_canvas(crop_rect, &x, &y, &w, &h);
+	canvas_crop(canvas, x, y, w, h);
+	render_pending = true;
 }
 
 static void
@@ -347,6 +431,8 @@ blur_begin(int16_t x, int16_t y)
 	blur.start.x = blur.end.x = x;
 	blur.start.y = blur.end.y = y;
 
+	update_selection();
+
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_crosshair);
 	xcb_flush(conn);
 }
@@ -360,32 +446,55 @@ blur_update(int16_t x, int16_t y)
 	blur.end.x = x;
 	blur.end.y = y;
 
-	canvas_render(canvas);
-	draw_dashed_rectangle(blur.start, blur.end);
-	xcb_flush(conn);
+	update_selection();
 }
 
 static void
 blur_end(void)
 {
 	xcb_rectangle_t blur_rect;
-	int x, y;
+	int x, y, w, h;
 
 	if (!blur.active)
 		return;
 
 	blur.active = false;
 	blur_rect = rect_from_two_points(blur.start, blur.end);
+	update_selection();
 
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_watch);
 	xcb_flush(conn);
-	canvas_viewport_to_canvas_pos(canvas, blur_rect.x, blur_rect.y, &x, &y);
+	viewport_rect_to_canvas(blur_rect, &x, &y, &w, &h);
 
 	// TODO: add more "filters" and change the right click filter with
 	// number keys 1-9 and n & p to move between next and previous filter
-	canvas_blur(canvas, x, y, blur_rect.width, blur_rect.height, 10);
+	canvas_blur(canvas, x, y, w, h, XCANDB_BLUR_STRENGTH);
 	xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_arrow);
-	canvas_render(canvas);
+	render_pending = true;
+}
+
+static void
+h_selection_request(xcb_selection_request_event_t *ev)
+{
+	clipboard_handle_request(ev);
+}
+
+static void
+h_selection_clear(xcb_selection_clear_event_t *ev)
+{
+	clipboard_handle_clear(ev);
+}
+
+static void
+h_property_notify(xcb_property_notify_event_t *ev)
+{
+	clipboard_handle_property(ev);
+}
+
+static void
+h_destroy_notify(xcb_destroy_notify_event_t *ev)
+{
+	clipboard_handle_destroy(ev);
 }
 
 static void
@@ -404,8 +513,16 @@ h_client_message(xcb_client_message_event_t *ev)
 static void
 h_expose(xcb_expose_event_t *ev)
 {
-	(void) ev;
-	canvas_render(canvas);
+	/* the server repaints the window background, */
+	/* which already holds the whole frame */
+	if (background_pixmap)
+		return;
+
+	canvas_damage(canvas, ev->x, ev->y, ev->width, ev->height);
+
+	/* more exposes follow, paint them all once the last one is in */
+	if (ev->count == 0)
+		render_pending = true;
 }
 
 static void
@@ -417,15 +534,39 @@ h_key_press(xcb_key_press_event_t *ev)
 
 	if (ev->state & XCB_MOD_MASK_CONTROL) {
 		switch (key) {
+		case XKB_KEY_c: copy(ev->time); return;
 		case XKB_KEY_s: save(); return;
+		case XKB_KEY_y: redo(); return;
+		case XKB_KEY_z:
+			if (ev->state & XCB_MOD_MASK_SHIFT) redo();
+			else undo();
+			return;
 		}
 	}
 
 	switch (key) {
 	case XKB_KEY_Escape:
 		crop.active = blur.active = false;
+		update_selection();
 		xcb_change_window_attributes(conn, win, XCB_CW_CURSOR, &cursor_arrow);
-		canvas_render(canvas);
+		break;
+	case XKB_KEY_plus:
+	case XKB_KEY_equal:
+		zoom(XCANDB_ZOOM_STEP, ev->event_x, ev->event_y);
+		break;
+	case XKB_KEY_minus:
+		zoom(1 / XCANDB_ZOOM_STEP, ev->event_x, ev->event_y);
+		break;
+	case XKB_KEY_0:
+		zoom(1 / canvas_get_zoom(canvas), ev->event_x, ev->event_y);
+		break;
+	case XKB_KEY_bracketleft:
+		if (canvas_adjust_strength(canvas, -1))
+			render_pending = true;
+		break;
+	case XKB_KEY_bracketright:
+		if (canvas_adjust_strength(canvas, 1))
+			render_pending = true;
 		break;
 	}
 }
@@ -443,18 +584,38 @@ h_button_press(xcb_button_press_event_t *ev)
 	case XCB_BUTTON_INDEX_3:
 		blur_begin(ev->event_x, ev->event_y);
 		break;
+	case XCB_BUTTON_INDEX_4:
+		zoom(XCANDB_ZOOM_STEP, ev->event_x, ev->event_y);
+		break;
+	case XCB_BUTTON_INDEX_5:
+		zoom(1 / XCANDB_ZOOM_STEP, ev->event_x, ev->event_y);
+		break;
 	}
 }
 
 static void
 h_motion_notify(xcb_motion_notify_event_t *ev)
 {
+	/* only the last position of a batch of events matters */
+	motion.pending = true;
+	motion.x = ev->event_x;
+	motion.y = ev->event_y;
+}
+
+static void
+flush_motion(void)
+{
+	if (!motion.pending)
+		return;
+
+	motion.pending = false;
+
 	if (drag.active)
-		drag_update(ev->event_x, ev->event_y);
+		drag_update(motion.x, motion.y);
 	if (crop.active)
-		crop_update(ev->event_x, ev->event_y);
+		crop_update(motion.x, motion.y);
 	if (blur.active)
-		blur_update(ev->event_x, ev->event_y);
+		blur_update(motion.x, motion.y);
 }
 
 static void
@@ -476,7 +637,23 @@ h_button_release(xcb_button_release_event_t *ev)
 static void
 h_configure_notify(xcb_configure_notify_event_t *ev)
 {
-	canvas_set_viewport(canvas, ev->width, ev->height);
+	/* clipboard requestors' windows report here too */
+	if (ev->window != win)
+		return;
+
+	/* no expose follows when the frame is the window */
+	/* background, the new one has to be painted here */
+	if (canvas_set_viewport(canvas, ev->width, ev->height))
+		render_pending = true;
+}
+
+static void
+h_generic(xcb_ge_generic_event_t *ev)
+{
+	/* a frame reached the screen, damage that came in */
+	/* while it was in flight can be presented now */
+	if (canvas_handle_event(canvas, (xcb_generic_event_t *)(ev)))
+		render_pending = true;
 }
 
 static void
@@ -486,10 +663,145 @@ h_mapping_notify(xcb_mapping_notify_event_t *ev)
 		xcb_refresh_keyboard_mapping(ksyms, ev);
 }
 
+static size_t
+parse_megabytes(const char *str)
+{
+	char *end;
+	unsigned long mb;
+
+	mb = strtoul(enotnull(str, "megabytes"), &end, 10);
+
+	if (*end != '\0' || mb > SIZE_MAX >> 20)
+		die("invalid size: %s", str);
+
+	return (size_t)mb << 20;
+}
+
+static void
+parse_geometry(const char *str)
+{
+	int n;
+
+	n = 0;
+	sscanf(enotnull(str, "geometry"), "%dx%d+%d+%d%n", &region.width,
+			&region.height, &region.x, &region.y, &n);
+
+	if (n == 0 || str[n] != '\0' || region.width < 1 ||
+			region.height < 1 || region.x < 0 || region.y < 0)
+		die("invalid geometry: %s", str);
+}
+
+static xcb_window_t
+parse_window(const char *str)
+{
+	char *end;
+	unsigned long id;
+
+	id = strtoul(enotnull(str, "window"), &end, 0);
+
+	if (*end != '\0' || id == 0 || id > UINT32_MAX)
+		die("invalid window: %s", str);
+
+	return id;
+}
+
+static void
+parse_edit(char type, const char *str)
+{
+	int n, m;
+
+	/* edits are applied without a window, likely from a */
+	/* script, where a notification would go unnoticed */
+	log_use_stderr();
+
+	if (nedits == XCANDB_EDITS_MAX)
+		die("too many edits");
+
+	n = m = 0;
+	edits[nedits].type = type;
+	edits[nedits].strength = XCANDB_BLUR_STRENGTH;
+
+	sscanf(enotnull(str, "rectangle"), "%d,%d,%d,%d%n", &edits[nedits].x,
+			&edits[nedits].y, &edits[nedits].width, &edits[nedits].height, &n);
+
+	/* blurs may say how strong after a colon */
+	if (n > 0 && type == 'b' && str[n] == ':') {
+		sscanf(&str[n+1], "%d%n", &edits[nedits].strength, &m);
+		n = m > 0 ? n + 1 + m : 0;
+	}
+
+	if (n == 0 || str[n] != '\0' || edits[nedits].strength < 1)
+		die("invalid rectangle: %s", str);
+
+	nedits++;
+}
+
+static void
+parse_batch(const char *path)
+{
+	FILE *fp;
+	char line[256];
+
+	log_use_stderr();
+
+	if (NULL == (fp = fopen(enotnull(path, "path"), "r")))
+		die("can't open %s", path);
+
+	/* one edit per line, as given to -b and -c: "b x,y,w,h" */
+	while (NULL != fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#')
+			continue;
+		if ((line[0] != 'b' && line[0] != 'c') || line[1] != ' ')
+			die("invalid edit: %s", line);
+		parse_edit(line[0], &line[2]);
+	}
+
+	fclose(fp);
+	batch = true;
+}
+
+static void
+edit_headless(const char *loadpath)
+{
+	Image_t *img;
+	int i;
+
+	/* no display is needed to apply edits given up front */
+	if (NULL == savepath)
+		die("an output path should be specified");
+
+	img = image_load(loadpath, region.x, region.y, region.width, region.height);
+
+	if (NULL == img)
+		die("could not load the specified image");
+
+	for (i = 0; i < nedits; ++i) {
+		if (edits[i].type == 'c')
+			image_crop(img, edits[i].x, edits[i].y, edits[i].width, edits[i].height);
+		else if (image_blur(img, edits[i].x, edits[i].y, edits[i].width,
+					edits[i].height, edits[i].strength) < 0)
+			die("could not blur the image");
+	}
+
+	if (image_save(img, savepath) < 0)
+		die("could not save the image");
+
+	image_free(img);
+}
+
+static void
+batch_failed(const char *path)
+{
+	info("could not process %s", path);
+}
+
 static void
 usage(void)
 {
-	puts("usage: xcandb [-fhv] [-l file]");
+	puts("usage: xcandb [-fhnprsv] [-b x,y,w,h[:strength]] [-c x,y,w,h] [-g geometry]\n"
+	     "              [-l file] [-m megabytes] [-o file] [-t megabytes] [-w window]\n"
+	     "       xcandb -B file -o directory file...");
 	exit(0);
 }
 
@@ -505,8 +817,14 @@ main(int argc, char **argv)
 {
 	const char *loadpath;
 	xcb_generic_event_t *ev;
+	unsigned char *data;
+	size_t len;
+	char **paths;
+	int npaths;
 
 	loadpath = NULL;
+	paths = xmalloc(argc * sizeof(char *));
+	npaths = 0;
 
 	while (++argv, --argc > 0) {
 		if ((*argv)[0] == '-' && (*argv)[1] != '\0' && (*argv)[2] == '\0') {
@@ -514,39 +832,132 @@ main(int argc, char **argv)
 			case 'h': usage(); break;
 			case 'v': version(); break;
 			case 'f': start_in_fullscreen = true; break;
+			case 'p': background_pixmap = true; break;
+			case 'r': xrender_zoom = true; break;
+			case 'n': edit_list = true; break;
+			case 's': capture = true; break;
+			case 'b': --argc; parse_edit('b', *++argv); break;
+			case 'c': --argc; parse_edit('c', *++argv); break;
+			case 'B': --argc; parse_batch(*++argv); break;
+			case 'g': --argc; parse_geometry(*++argv); break;
 			case 'l': --argc; loadpath = enotnull(*++argv, "path"); break;
+			case 'o': --argc; savepath = enotnull(*++argv, "path"); break;
+			case 'm': --argc; history_budget = parse_megabytes(*++argv); break;
+			case 't': --argc; canvas_set_ram_budget(parse_megabytes(*++argv)); break;
+			case 'w': --argc; capture = true; capture_window = parse_window(*++argv); break;
 			default: die("invalid option %s", *argv); break;
 			}
 		} else {
-			die("unexpected argument: %s", *argv);
+			paths[npaths++] = *argv;
 		}
 	}
 
-	if (NULL == loadpath)
+	if (batch) {
+		if (NULL == savepath)
+			die("an output directory should be specified");
+		if (npaths == 0)
+			die("no images were given");
+		npaths = batch_run(paths, npaths, edits, nedits, savepath, batch_failed);
+		free(paths);
+		if (npaths < 0)
+			die("could not start the batch, are two images named the same?");
+		if (npaths > 0)
+			die("%d images could not be processed", npaths);
+		return 0;
+	}
+
+	if (npaths > 0)
+		die("unexpected argument: %s", paths[0]);
+
+	free(paths);
+
+	if (NULL == loadpath && !capture)
 		die("a path should be specified");
 
+	if (nedits > 0) {
+		if (capture)
+			die("edits can't be given when capturing");
+		edit_headless(loadpath);
+		return 0;
+	}
+
 	xwininit();
+	clipboard_init(conn, win);
+
+	/* the window is mapped afterwards, so it isn't captured */
+	if (capture) {
+		canvas = canvas_capture(conn, win, capture_window ? capture_window : scr->root,
+				region.x, region.y, region.width, region.height);
+		if (NULL == canvas)
+			die("could not capture the specified window");
+	} else if (strcmp(loadpath, "clipboard") == 0) {
+		if (NULL == (data = clipboard_read(&len)))
+			die("the clipboard holds no image");
+		canvas = canvas_load_memory(conn, win, data, len, region.x,
+				region.y, region.width, region.height);
+		free(data);
+		if (NULL == canvas)
+			die("could not load the image in the clipboard");
+	} else {
+		canvas = canvas_load_region(conn, win, loadpath, region.x,
+				region.y, region.width, region.height);
+		if (NULL == canvas)
+			die("could not load the specified image");
+	}
 
-	canvas = canvas_load(conn, win, loadpath);
+	canvas_set_background(canvas, XCANDB_BACKGROUND);
 
-	if (NULL == canvas)
-		die("could not load the specified image");
+	if (background_pixmap) {
+		canvas_use_window_background(canvas);
+		render_pending = true;
+	}
+
+	canvas_set_history_budget(canvas, history_budget);
+
+	if (edit_list)
+		canvas_use_edit_list(canvas);
+
+	if (xrender_zoom && canvas_use_xrender_zoom(canvas) < 0)
+		info("xrender zoom is not available, zooming on the cpu");
+
+	xcb_map_window(conn, win);
+	xcb_flush(conn);
 
 	while (!should_close && (ev = xcb_wait_for_event(conn))) {
-		switch (ev->response_type & ~0x80) {
-		case XCB_CLIENT_MESSAGE:     h_client_message((void *)(ev)); break;
-		case XCB_EXPOSE:             h_expose((void *)(ev)); break;
-		case XCB_KEY_PRESS:          h_key_press((void *)(ev)); break;
-		case XCB_BUTTON_PRESS:       h_button_press((void *)(ev)); break;
-		case XCB_MOTION_NOTIFY:      h_motion_notify((void *)(ev)); break;
-		case XCB_BUTTON_RELEASE:     h_button_release((void *)(ev)); break;
-		case XCB_CONFIGURE_NOTIFY:   h_configure_notify((void *)(ev)); break;
-		case XCB_MAPPING_NOTIFY:     h_mapping_notify((void *)(ev)); break;
-		}
+		/* handle everything already queued, then paint once */
+		do {
+			/* other events must see the pointer where it was */
+			if ((ev->response_type & ~0x80) != XCB_MOTION_NOTIFY)
+				flush_motion();
+
+			switch (ev->response_type & ~0x80) {
+			case XCB_CLIENT_MESSAGE:     h_client_message((void *)(ev)); break;
+			case XCB_EXPOSE:             h_expose((void *)(ev)); break;
+			case XCB_KEY_PRESS:          h_key_press((void *)(ev)); break;
+			case XCB_BUTTON_PRESS:       h_button_press((void *)(ev)); break;
+			case XCB_MOTION_NOTIFY:      h_motion_notify((void *)(ev)); break;
+			case XCB_BUTTON_RELEASE:     h_button_release((void *)(ev)); break;
+			case XCB_CONFIGURE_NOTIFY:   h_configure_notify((void *)(ev)); break;
+			case XCB_MAPPING_NOTIFY:     h_mapping_notify((void *)(ev)); break;
+			case XCB_GE_GENERIC:         h_generic((void *)(ev)); break;
+			case XCB_SELECTION_REQUEST:  h_selection_request((void *)(ev)); break;
+			case XCB_SELECTION_CLEAR:    h_selection_clear((void *)(ev)); break;
+			case XCB_PROPERTY_NOTIFY:    h_property_notify((void *)(ev)); break;
+			case XCB_DESTROY_NOTIFY:     h_destroy_notify((void *)(ev)); break;
+			}
+
+			free(ev);
+		} while (!should_close && (ev = xcb_poll_for_queued_event(conn)));
 
-		free(ev);
+		flush_motion();
+
+		if (render_pending) {
+			render_pending = false;
+			canvas_render(canvas);
+		}
 	}
 
+	clipboard_free();
 	canvas_free(canvas);
 	xwindestroy();
 